@@ -0,0 +1,640 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <netdb.h>
+#include "protocol.h"
+#define ERR(source) (perror(source),\
+		     fprintf(stderr,"%s:%d\n",__FILE__,__LINE__),\
+		     exit(EXIT_FAILURE))
+#define HERR(source) (fprintf(stderr,"%s(%d) at %s:%d\n",source,h_errno,__FILE__,__LINE__),\
+		     exit(EXIT_FAILURE))
+
+#define MAX_LEN 256
+#define MAX_EVENTS 256
+#define GAME_CELLS 25
+
+// failed connection is retried after RETRY_US, samples arrays start with SAMPLE_CHUNK
+#define RETRY_US 100000
+#define SAMPLE_CHUNK 4096
+
+// simulated player phases
+#define BENCH_IDLE 0
+#define BENCH_CONNECTING 1
+#define BENCH_PLAYING 2
+
+// PLAYER_STRUCT - one simulated player, it reconnects after every game
+typedef struct {
+
+	int socket, phase;
+
+	// X or O once known, 0 before
+	char symbol;
+
+	// set when result came, set when move or reconnect is scheduled
+	int over, scheduled;
+
+	// local board from snapshots and deltas, number of taken cells
+	char board[GAME_CELLS];
+	int taken;
+
+	// move waiting for its delta and time it was sent, 0 if none
+	int cell;
+	int64_t sent_us;
+
+	// time connect started
+	int64_t connect_us;
+
+	// legacy frame is the longest one
+	char in[PROTO_HEADER + MAX_LEN];
+	size_t inlen;
+
+} player_struct;
+
+// TIMER_STRUCT - move or reconnect of player due at given time
+typedef struct {
+
+	int64_t due;
+	int player;
+
+} timer_struct;
+
+// SAMPLES_STRUCT - latencies in microseconds
+typedef struct {
+
+	uint32_t* us;
+	long len, size;
+
+} samples_struct;
+
+// WORKER_STRUCT - thread driving its share of players with own epoll
+typedef struct {
+
+	pthread_t thread;
+	int id, epollfd;
+	unsigned seed;
+
+	player_struct* players;
+	int len;
+
+	// binary heap of timers ordered by due time, one per player at most
+	timer_struct* timers;
+	int timers_len;
+
+	// counters and latency samples merged by main thread
+	long connects, connect_errors, drops, full, games, moves, chats;
+	samples_struct rtt, connect;
+
+} worker_struct;
+
+volatile sig_atomic_t do_work=1;
+
+// server address, TCP or unix socket
+struct sockaddr_storage address;
+socklen_t address_len;
+int64_t deadline;
+
+// think time before each move, percent of moves preceded by chat
+int64_t think_us = 0;
+int chat_percent = 0;
+
+// preferred cells of scripted games, random legal moves if empty
+int script[GAME_CELLS];
+int script_len = 0;
+
+void sigint_handler(int sig){
+	do_work = 0;
+}
+
+int sethandler( void (*f)(int), int sigNo){
+	struct sigaction act;
+	memset(&act, 0, sizeof(struct sigaction));
+	act.sa_handler = f;
+	if (-1==sigaction(sigNo, &act, NULL))
+		return -1;
+	return 0;
+}
+
+void usage(char* name){
+	fprintf(stderr,"USAGE: %s [-n CONNS] [-t THREADS] [-d SECONDS] [-r RATE] [-m PERCENT] [-s CELLS] HOST PORT | -u PATH\n",name);
+	fprintf(stderr,"\t-n CONNS\tsimulated players, default 1000\n");
+	fprintf(stderr,"\t-t THREADS\tload generator threads, default 4\n");
+	fprintf(stderr,"\t-d SECONDS\tbenchmark length, default 10\n");
+	fprintf(stderr,"\t-r RATE\ttarget moves per second of all games, default as fast as server answers\n");
+	fprintf(stderr,"\t-m PERCENT\tmoves preceded by private chat message, default 0\n");
+	fprintf(stderr,"\t-s CELLS\tscripted games, comma separated cells tried in order before random ones\n");
+	fprintf(stderr,"\t-u PATH\tconnect through unix socket of server on this host instead of HOST PORT\n");
+	fprintf(stderr,"prints one JSON object with connect rate, moves per second and move round trip percentiles\n");
+}
+
+// monotonic time in microseconds
+int64_t nowUs(){
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0) ERR("clock_gettime");
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void make_address(char *name, uint16_t port){
+	struct sockaddr_in* addr = (struct sockaddr_in*)&address;
+	struct hostent *hostinfo;
+	memset(&address, 0, sizeof(address));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons (port);
+	hostinfo = gethostbyname(name);
+	if(NULL == hostinfo) HERR("gethostbyname");
+	addr->sin_addr = *(struct in_addr*) hostinfo->h_addr;
+	address_len = sizeof(struct sockaddr_in);
+}
+
+void make_unix_address(char *path){
+	struct sockaddr_un* addr = (struct sockaddr_un*)&address;
+	memset(&address, 0, sizeof(address));
+	addr->sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr->sun_path)){
+		fprintf(stderr,"socket path too long: %s\n",path);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(addr->sun_path, path);
+	address_len = sizeof(struct sockaddr_un);
+}
+
+// parses comma separated cells of scripted games, returns 0 on bad cell
+int parseScript(char* arg){
+	char* end;
+	long cell;
+	for(script_len = 0; script_len < GAME_CELLS && '\0' != *arg; script_len++){
+		cell = strtol(arg, &end, 10);
+		if(end == arg || cell < 0 || cell >= GAME_CELLS){
+			return 0;
+		}
+		script[script_len] = cell;
+		arg = ',' == *end ? end + 1 : end;
+	}
+	return 1;
+}
+
+void samplePush(samples_struct* s, int64_t us){
+	if(s->len == s->size){
+		s->size = s->size ? s->size * 2 : SAMPLE_CHUNK;
+		if(NULL == (s->us = realloc(s->us, s->size * sizeof(uint32_t)))) ERR("realloc");
+	}
+	s->us[s->len++] = us > UINT32_MAX ? UINT32_MAX : us;
+}
+
+int sampleCompare(const void* a, const void* b){
+	uint32_t x = *(uint32_t*)a, y = *(uint32_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+// value below which given fraction of sorted samples falls
+uint32_t samplePercentile(samples_struct* s, double fraction){
+	long i = fraction * s->len;
+	if(0 == s->len){
+		return 0;
+	}
+	return s->us[i < s->len ? i : s->len - 1];
+}
+
+void timerPush(worker_struct* w, int64_t due, int player){
+	int i = w->timers_len++;
+	timer_struct t = {due, player};
+	while(i > 0 && w->timers[(i - 1) / 2].due > due){
+		w->timers[i] = w->timers[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	w->timers[i] = t;
+}
+
+timer_struct timerPop(worker_struct* w){
+	timer_struct top = w->timers[0];
+	timer_struct last = w->timers[--w->timers_len];
+	int i = 0, child;
+	while((child = 2 * i + 1) < w->timers_len){
+		if(child + 1 < w->timers_len && w->timers[child + 1].due < w->timers[child].due){
+			child++;
+		}
+		if(last.due <= w->timers[child].due){
+			break;
+		}
+		w->timers[i] = w->timers[child];
+		i = child;
+	}
+	w->timers[i] = last;
+	return top;
+}
+
+// schedules move or reconnect of player
+void playerSchedule(worker_struct* w, int num, int64_t due){
+	w->players[num].scheduled = 1;
+	timerPush(w, due, num);
+}
+
+// closes player connection and schedules new one, failed ones wait a while
+void playerClose(worker_struct* w, int num, int failed){
+	player_struct* p = &w->players[num];
+	if(-1 != p->socket && TEMP_FAILURE_RETRY(close(p->socket)) < 0) ERR("close");
+	p->socket = -1;
+	p->phase = BENCH_IDLE;
+
+	// pending move timer reconnects idle player instead
+	if(!p->scheduled){
+		playerSchedule(w, num, nowUs() + (failed ? RETRY_US : 0));
+	}
+}
+
+// sends whole binary frame, player that can not take it is dropped
+int playerSend(worker_struct* w, int num, int type, char* data, int len){
+	char frame[MAX_LEN + PROTO_HEADER];
+	player_struct* p = &w->players[num];
+	frame[0] = type;
+	frame[1] = len;
+	memcpy(frame + PROTO_HEADER, data, len);
+	if(PROTO_HEADER + len != TEMP_FAILURE_RETRY(send(p->socket, frame, PROTO_HEADER + len, MSG_NOSIGNAL))){
+		w->drops++;
+		playerClose(w, num, 1);
+		return -1;
+	}
+	return 0;
+}
+
+// starts non blocking connect, it completes when socket becomes writable
+void playerConnect(worker_struct* w, int num){
+	struct epoll_event ev;
+	player_struct* p = &w->players[num];
+	int one = 1;
+	if(-1 == (p->socket = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))){
+		w->connect_errors++;
+		playerClose(w, num, 1);
+		return;
+	}
+	// chat and move go out as separate small writes, Nagle would hold the move back
+	if(AF_INET == address.ss_family && setsockopt(p->socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one))) ERR("setsockopt");
+	p->connect_us = nowUs();
+
+	// unix socket connects at once or fails with EAGAIN when backlog is full
+	if(connect(p->socket, (struct sockaddr*)&address, address_len) < 0 && EINPROGRESS != errno){
+		w->connect_errors++;
+		playerClose(w, num, 1);
+		return;
+	}
+	p->phase = BENCH_CONNECTING;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT;
+	ev.data.u32 = num;
+	if(-1 == epoll_ctl(w->epollfd, EPOLL_CTL_ADD, p->socket, &ev)) ERR("epoll_ctl");
+}
+
+// finishes connect and switches to binary protocol
+void playerConnected(worker_struct* w, int num){
+	struct epoll_event ev;
+	player_struct* p = &w->players[num];
+	socklen_t size = sizeof(int);
+	int status;
+	if(getsockopt(p->socket, SOL_SOCKET, SO_ERROR, &status, &size) < 0) ERR("getsockopt");
+	if(0 != status){
+		w->connect_errors++;
+		playerClose(w, num, 1);
+		return;
+	}
+	w->connects++;
+	samplePush(&w->connect, nowUs() - p->connect_us);
+	p->phase = BENCH_PLAYING;
+	p->symbol = 0;
+	p->over = p->taken = p->cell = 0;
+	p->sent_us = 0;
+	p->inlen = 0;
+	memset(p->board, '-', GAME_CELLS);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = num;
+	if(-1 == epoll_ctl(w->epollfd, EPOLL_CTL_MOD, p->socket, &ev)) ERR("epoll_ctl");
+	playerSend(w, num, PROTO_HELLO, PROTO_MAGIC, strlen(PROTO_MAGIC));
+}
+
+// picks first free scripted cell or random free one, -1 if board is full
+int playerCell(worker_struct* w, player_struct* p){
+	int i, n, free = GAME_CELLS - p->taken;
+	for(i = 0; i < script_len; i++){
+		if('-' == p->board[script[i]]){
+			return script[i];
+		}
+	}
+	if(free <= 0){
+		return -1;
+	}
+	n = rand_r(&w->seed) % free;
+	for(i = 0; i < GAME_CELLS; i++){
+		if('-' == p->board[i] && 0 == n--){
+			return i;
+		}
+	}
+	return -1;
+}
+
+// sends move on player turn, some of them after chat message
+void playerMove(worker_struct* w, int num){
+	player_struct* p = &w->players[num];
+	char cell;
+	int move;
+	if(BENCH_PLAYING != p->phase || p->over || -1 == (move = playerCell(w, p))){
+		return;
+	}
+	if(chat_percent > rand_r(&w->seed) % 100){
+		if(playerSend(w, num, MSG_CHAT, "good luck", 9) < 0) return;
+		w->chats++;
+	}
+	cell = move;
+	p->cell = move;
+	p->sent_us = nowUs();
+	playerSend(w, num, MSG_MOVE, &cell, 1);
+}
+
+// moves now or after think time if it is player turn
+void playerTurn(worker_struct* w, int num){
+	player_struct* p = &w->players[num];
+	if(p->over || 0 == p->symbol || p->sent_us || p->scheduled
+		|| (0 == p->taken % 2) != ('X' == p->symbol)){
+		return;
+	}
+	if(think_us){
+		playerSchedule(w, num, nowUs() + think_us);
+		return;
+	}
+	playerMove(w, num);
+}
+
+// handles frame from server, legacy frames come only before hello is read
+void playerFrame(worker_struct* w, int num, int type, char* data, int len){
+	player_struct* p = &w->players[num];
+	int i, cell;
+	switch(type){
+		case MSG_TEXT:
+			if(memmem(data, len, "nickname", 8)){
+				char nick[32];
+				snprintf(nick, sizeof(nick), "bench%d_%d", w->id, num);
+				playerSend(w, num, MSG_NICK, nick, strlen(nick));
+			} else if(memmem(data, len, "Server is full", 14)){
+				w->full++;
+			}
+			break;
+
+		// X gets empty board when game starts, later snapshots replace coalesced deltas
+		case MSG_BOARD:
+			if(len < GAME_CELLS) break;
+			memcpy(p->board, data, GAME_CELLS);
+			for(p->taken = i = 0; i < GAME_CELLS; i++){
+				p->taken += '-' != p->board[i];
+			}
+			if(0 == p->symbol && 0 == p->taken){
+				p->symbol = 'X';
+			}
+			playerTurn(w, num);
+			break;
+		case MSG_DELTA:
+			if(len < 3 || (cell = (unsigned char)data[0]) >= GAME_CELLS) break;
+			p->board[cell] = data[1];
+			p->taken = (unsigned char)data[2];
+			if(0 == p->symbol){
+				p->symbol = 'X' == data[1] ? 'O' : 'X';
+			}
+
+			// own move came back, round trip ends
+			if(data[1] == p->symbol && cell == p->cell && p->sent_us){
+				samplePush(&w->rtt, nowUs() - p->sent_us);
+				p->sent_us = 0;
+				w->moves++;
+			}
+			playerTurn(w, num);
+			break;
+		case MSG_RESULT:
+			p->over = 1;
+			break;
+		case MSG_END:
+			if('X' == p->symbol && p->over){
+				w->games++;
+			}
+			playerClose(w, num, 0);
+			break;
+	}
+}
+
+// reads available data and handles every complete frame
+void playerRead(worker_struct* w, int num){
+	player_struct* p = &w->players[num];
+	size_t need;
+	ssize_t n;
+	int socket = p->socket;
+
+	n = TEMP_FAILURE_RETRY(read(socket, p->in + p->inlen, sizeof(p->in) - p->inlen));
+	if(n < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)){
+		return;
+	}
+	if(n <= 0){
+		if(n < 0 && ECONNRESET != errno) ERR("read");
+		w->drops++;
+		playerClose(w, num, 1);
+		return;
+	}
+	p->inlen += n;
+	for(;;){
+		need = PROTO_IS_BINARY(p->in[0]) ? PROTO_HEADER + (unsigned char)p->in[1] : MAX_LEN;
+		if(p->inlen < PROTO_HEADER || p->inlen < need){
+			return;
+		}
+		if(PROTO_IS_BINARY(p->in[0])){
+			playerFrame(w, num, (unsigned char)p->in[0], p->in + PROTO_HEADER, need - PROTO_HEADER);
+		} else {
+			p->in[MAX_LEN - 1] = '\0';
+			playerFrame(w, num, '\0' == p->in[0] ? MSG_END : MSG_TEXT, p->in, strlen(p->in));
+		}
+
+		// frame may have closed connection
+		if(socket != p->socket){
+			return;
+		}
+		p->inlen -= need;
+		memmove(p->in, p->in + need, p->inlen);
+	}
+}
+
+// connects all players of the worker and plays until deadline
+void* workerThread(void* arg){
+	struct epoll_event events[MAX_EVENTS];
+	worker_struct* w = arg;
+	int64_t now;
+	int i, n, num, timeout;
+	timer_struct t;
+
+	if(-1 == (w->epollfd = epoll_create1(EPOLL_CLOEXEC))) ERR("epoll_create1");
+	for(i = 0; i < w->len; i++){
+		w->players[i].socket = -1;
+		playerConnect(w, i);
+	}
+	while(do_work && (now = nowUs()) < deadline){
+		while(w->timers_len > 0 && w->timers[0].due <= now){
+			t = timerPop(w);
+			w->players[t.player].scheduled = 0;
+			if(BENCH_IDLE == w->players[t.player].phase){
+				playerConnect(w, t.player);
+			} else {
+				playerMove(w, t.player);
+			}
+		}
+		timeout = (deadline - now + 999) / 1000;
+		if(w->timers_len > 0 && w->timers[0].due - now < deadline - now){
+			timeout = (w->timers[0].due - now + 999) / 1000;
+		}
+		if(-1 == (n = epoll_wait(w->epollfd, events, MAX_EVENTS, timeout))){
+			if(EINTR == errno){
+				continue;
+			}
+			ERR("epoll_wait");
+		}
+		for(i = 0; i < n; i++){
+			num = events[i].data.u32;
+			if(BENCH_CONNECTING == w->players[num].phase){
+				playerConnected(w, num);
+			} else if(BENCH_PLAYING == w->players[num].phase){
+				playerRead(w, num);
+			}
+		}
+	}
+	for(i = 0; i < w->len; i++){
+		if(-1 != w->players[i].socket && TEMP_FAILURE_RETRY(close(w->players[i].socket)) < 0) ERR("close");
+	}
+	if(TEMP_FAILURE_RETRY(close(w->epollfd)) < 0) ERR("close");
+	return NULL;
+}
+
+// adds worker samples to total ones
+void samplesMerge(samples_struct* total, samples_struct* s){
+	long i;
+	for(i = 0; i < s->len; i++){
+		samplePush(total, s->us[i]);
+	}
+	free(s->us);
+}
+
+void printResults(worker_struct* workers, int threads, int conns, double seconds){
+	samples_struct rtt = {NULL, 0, 0}, connect = {NULL, 0, 0};
+	long connects = 0, errors = 0, drops = 0, full = 0, games = 0, moves = 0, chats = 0;
+	int i;
+	for(i = 0; i < threads; i++){
+		connects += workers[i].connects;
+		errors += workers[i].connect_errors;
+		drops += workers[i].drops;
+		full += workers[i].full;
+		games += workers[i].games;
+		moves += workers[i].moves;
+		chats += workers[i].chats;
+		samplesMerge(&rtt, &workers[i].rtt);
+		samplesMerge(&connect, &workers[i].connect);
+	}
+	qsort(rtt.us, rtt.len, sizeof(uint32_t), sampleCompare);
+	qsort(connect.us, connect.len, sizeof(uint32_t), sampleCompare);
+	printf("{\"connections\":%d,\"threads\":%d,\"seconds\":%.3f,", conns, threads, seconds);
+	printf("\"connects\":%ld,\"connect_rate\":%.1f,\"connect_errors\":%ld,\"drops\":%ld,\"server_full\":%ld,",
+		connects, connects / seconds, errors, drops, full);
+	printf("\"connect_us\":{\"p50\":%u,\"p99\":%u},",
+		samplePercentile(&connect, 0.5), samplePercentile(&connect, 0.99));
+	printf("\"games\":%ld,\"moves\":%ld,\"moves_per_sec\":%.1f,\"chats\":%ld,",
+		games, moves, moves / seconds, chats);
+	printf("\"move_rtt_us\":{\"p50\":%u,\"p99\":%u,\"p999\":%u,\"max\":%u}}\n",
+		samplePercentile(&rtt, 0.5), samplePercentile(&rtt, 0.99), samplePercentile(&rtt, 0.999),
+		rtt.len ? rtt.us[rtt.len - 1] : 0);
+	free(rtt.us);
+	free(connect.us);
+}
+
+int main(int argc, char** argv){
+	worker_struct* workers;
+	player_struct* players;
+	int conns = 1000, threads = 4, seconds = 10;
+	double rate = 0;
+	int64_t start;
+	char* path = NULL;
+	int opt, i;
+
+	while(-1 != (opt = getopt(argc, argv, "n:t:d:r:m:s:u:"))){
+		switch(opt){
+			case 'n':
+				conns = atoi(optarg);
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 'd':
+				seconds = atoi(optarg);
+				break;
+			case 'r':
+				rate = atof(optarg);
+				break;
+			case 'm':
+				chat_percent = atoi(optarg);
+				break;
+			case 'u':
+				path = optarg;
+				break;
+			case 's':
+				if(!parseScript(optarg)){
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if(argc - optind != (NULL == path ? 2 : 0) || conns < 2 || threads < 1 || threads > conns || seconds < 1
+		|| rate < 0 || chat_percent < 0 || chat_percent > 100){
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(NULL == path){
+		make_address(argv[optind], atoi(argv[optind + 1]));
+	} else {
+		make_unix_address(path);
+	}
+
+	// every game has one move in flight, so rate is reached by thinking between moves
+	if(rate > 0){
+		think_us = conns / 2 / rate * 1e6;
+	}
+
+	if(sethandler(SIG_IGN,SIGPIPE)) ERR("Seting SIGPIPE:");
+	if(sethandler(sigint_handler,SIGINT)) ERR("Seting SIGINT:");
+
+	if(NULL == (workers = calloc(threads, sizeof(worker_struct)))) ERR("calloc");
+	if(NULL == (players = calloc(conns, sizeof(player_struct)))) ERR("calloc");
+	start = nowUs();
+	deadline = start + (int64_t)seconds * 1000000;
+	for(i = 0; i < threads; i++){
+		workers[i].id = i;
+		workers[i].seed = start + i;
+		workers[i].players = players + (long)conns * i / threads;
+		workers[i].len = (long)conns * (i + 1) / threads - (long)conns * i / threads;
+		if(NULL == (workers[i].timers = malloc(workers[i].len * sizeof(timer_struct)))) ERR("malloc");
+		if(pthread_create(&workers[i].thread, NULL, workerThread, &workers[i])) ERR("pthread_create");
+	}
+	for(i = 0; i < threads; i++){
+		if(pthread_join(workers[i].thread, NULL)) ERR("pthread_join");
+		free(workers[i].timers);
+	}
+	printResults(workers, threads, conns, (nowUs() - start) / 1e6);
+	free(players);
+	free(workers);
+	return EXIT_SUCCESS;
+}
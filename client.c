@@ -6,11 +6,13 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <netinet/in.h>
 #include <signal.h>
 #include <netdb.h>
+#include "protocol.h"
 #define ERR(source) (perror(source),\
 		     fprintf(stderr,"%s:%d\n ",__FILE__,__LINE__),\
 		     exit(EXIT_FAILURE))
@@ -28,6 +30,18 @@ volatile sig_atomic_t do_work=1;
 // process id
 pid_t clientInputReaderProccessId;	     
 
+// PROTO_LEGACY or PROTO_BINARY, set by -b
+int proto = PROTO_LEGACY;
+
+// token of game to resume, set by -r
+char* resume = NULL;
+
+// local copy of the board kept from binary snapshots and deltas
+char board[25];
+
+// number of taken cells on local board
+int boardSeq = 0;
+
 ssize_t bulk_write(int fd, char *buf, size_t count);
 
 // safe closing a file descriptor  of a socket
@@ -84,11 +98,11 @@ void sigchld_handler(int sig){
 }
 
 // creates socket for communication
-int make_socket(void){
+int make_socket(int domain){
 	int sock;
 	
 	// -1 on fail or file descriptor id
-	sock = socket(PF_INET,SOCK_STREAM,0);
+	sock = socket(domain,SOCK_STREAM,0);
 	if(sock < 0) ERR("socket");
 	return sock;
 }
@@ -105,16 +119,12 @@ struct sockaddr_in make_address(char *address, uint16_t port){
 	return addr;
 }
 
-int connect_socket(char *name, uint16_t port){
-	struct sockaddr_in addr;
-	int socketfd;
+// connects socket to address, connect interrupted by signal is waited for
+void connect_address(int socketfd, struct sockaddr* addr, socklen_t addrlen){
 	int status;
 	
-	socketfd = make_socket();
-	addr = make_address(name,port);
-	
 	// establish connection on socket
-	if(connect(socketfd,(struct sockaddr*) &addr,sizeof(struct sockaddr_in)) < 0){
+	if(connect(socketfd,addr,addrlen) < 0){
 		if (EINTR != errno) ERR("connect");
 			
 		// if the only error was interupt keep n working
@@ -134,6 +144,32 @@ int connect_socket(char *name, uint16_t port){
 			if(0 != status) ERR("connect");			
 		}
 	}
+}
+
+int connect_socket(char *name, uint16_t port){
+	struct sockaddr_in addr;
+	int socketfd;
+	
+	socketfd = make_socket(PF_INET);
+	addr = make_address(name,port);
+	connect_address(socketfd,(struct sockaddr*) &addr,sizeof(struct sockaddr_in));
+	return socketfd;
+}
+
+// connects to server running on this host, no TCP on the way
+int connect_unix_socket(char *path){
+	struct sockaddr_un addr;
+	int socketfd;
+	
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		fprintf(stderr,"socket path too long: %s\n",path);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(addr.sun_path, path);
+	socketfd = make_socket(PF_UNIX);
+	connect_address(socketfd,(struct sockaddr*) &addr,sizeof(struct sockaddr_un));
 	return socketfd;
 }
 
@@ -174,7 +210,11 @@ ssize_t bulk_write(int fd, char *buf, size_t count){
 
 // info function
 void usage(char * name){
-	fprintf(stderr,"USAGE: %s [DOMAIN] [PORT] \n",name);
+	fprintf(stderr,"USAGE: %s [-b] [-r TOKEN] [DOMAIN] [PORT] \n",name);
+	fprintf(stderr,"       %s [-b] [-r TOKEN] -u PATH\n",name);
+	fprintf(stderr,"\t-b\tuse binary protocol\n");
+	fprintf(stderr,"\t-u PATH\tconnect to server on this host through its unix socket PATH\n");
+	fprintf(stderr,"\t-r TOKEN\tresume game of dropped connection instead of giving nickname\n");
 }
 
 // replaces return carriage and new line with null symbol
@@ -190,29 +230,139 @@ void filterData(char *name, int len){
 	}
 }
 
+// prints board with cell numbers like legacy server does
+void printBoard(char* b){
+	int i;
+	for(i=0; i<5; i++){
+		fprintf(stderr, "%c | %c | %c | %c | %c\t %02d | %02d | %02d | %02d | %02d\n", b[i*5], b[i*5+1], b[i*5+2], b[i*5+3], b[i*5+4], i*5, i*5+1, i*5+2, i*5+3, i*5+4);
+	}
+	fprintf(stderr, "You can make move by typing number from 00 to 24.\nChat all simply by preciding your message with @ or chat directly to your opponent.\nJoin room with /join NAME, leave it with /leave NAME and talk there with #NAME\n");
+}
+
+// replaces local board with snapshot, server sends it again after dropping deltas
+void applyBoard(char* snapshot){
+	int i;
+	memcpy(board, snapshot, 25);
+	for (boardSeq = i = 0; i < 25; i++){
+		if ('-' != board[i]){
+			boardSeq++;
+		}
+	}
+}
+
+// applies cell change to local board
+void applyDelta(char* delta){
+	int cell = (unsigned char)delta[0];
+	if (cell >= 25){
+		return;
+	}
+	if ('-' == board[cell]){
+		boardSeq++;
+	}
+	board[cell] = delta[1];
+
+	// missed update, local board can only be wrong until next snapshot
+	if (boardSeq != delta[2]){
+		fprintf(stderr, "Board out of sync (%d of %d moves)\n", boardSeq, delta[2]);
+		boardSeq = delta[2];
+	}
+}
+
+// reads legacy or binary frame, returns message type or -1 on error
+// legacy frames are returned as MSG_TEXT or MSG_END for empty frame
+int readFrame(int socket, char* data){
+	int type, len;
+	if(1 != bulk_read(socket, data, 1)){
+		return -1;
+	}
+	if(!PROTO_IS_BINARY(data[0])){
+		if(MAX_LEN - 1 != bulk_read(socket, data + 1, MAX_LEN - 1)){
+			return -1;
+		}
+		data[MAX_LEN - 1] = '\0';
+		return '\0' == data[0] ? MSG_END : MSG_TEXT;
+	}
+	type = (unsigned char)data[0];
+	if(1 != bulk_read(socket, data, 1)){
+		return -1;
+	}
+	len = (unsigned char)data[0];
+	if(len != bulk_read(socket, data, len)){
+		return -1;
+	}
+	data[len] = '\0';
+	return type;
+}
+
 // handle recieved data
 void fetchSocketData( int socket ){
 	char data[MAX_LEN];
-	int size;
+	int type;
 	
 	while (do_work){
-		if( ((size = bulk_read(socket,data,MAX_LEN)) < 0) 
-			|| (MAX_LEN != size) 
-			|| (0 == data[0]) ){
+		if( ((type = readFrame(socket, data)) < 0) 
+			|| (MSG_END == type) ){
 			
 			// free socket after reading
 			if (do_work && safe_close(socket)<0) ERR("close");
 			
 			return;
 		}				
-		fprintf(stderr,"%s\n", data);
+		if (MSG_BOARD == type){
+			applyBoard(data);
+			printBoard(board);
+		} else if (MSG_DELTA == type){
+			applyDelta(data);
+			printBoard(board);
+		} else if (MSG_SESSION == type){
+			fprintf(stderr,"Session %s, if connection drops run client with -r %s\n", data, data);
+		} else {
+			fprintf(stderr,"%s\n", data);
+		}
 	}	
 }
 
+// sends binary frame
+void sendMsg(int socket, int type, char* data, int len){
+	char frame[MAX_LEN + PROTO_HEADER];
+	frame[0] = type;
+	frame[1] = len;
+	memcpy(frame + PROTO_HEADER, data, len);
+	if(bulk_write(socket, frame, PROTO_HEADER + len) < 0) ERR("write:");
+}
+
+// asks server to talk binary protocol
+void sendHello(int socket){
+	sendMsg(socket, PROTO_HELLO, PROTO_MAGIC, strlen(PROTO_MAGIC));
+}
+
+// sends typed line as binary message
+void sendLine(int socket, char* data, int nick){
+	char move;
+	if (nick){
+		sendMsg(socket, MSG_NICK, data, strlen(data));
+
+	// moves are 00-24 like in legacy protocol
+	} else if (data[0] >= '0' && data[0] <= '2'
+				&& data[1] >= '0' && data[1] <= '9'
+				&& (move = (data[0] - '0') * 10 + data[1] - '0') < 25){
+		sendMsg(socket, MSG_MOVE, &move, 1);
+	} else if ('@' == data[0]){
+		sendMsg(socket, MSG_CHATALL, data + 1, strlen(data + 1));
+	} else if ('#' == data[0]){
+		sendMsg(socket, MSG_ROOM, data + 1, strlen(data + 1));
+	} else if (0 == strncmp(data, "/join ", 6)){
+		sendMsg(socket, MSG_JOIN, data + 6, strlen(data + 6));
+	} else if (0 == strncmp(data, "/leave ", 7)){
+		sendMsg(socket, MSG_LEAVE, data + 7, strlen(data + 7));
+	} else {
+		sendMsg(socket, MSG_CHAT, data, strlen(data));
+	}
+}
 
 // read client input in async manner
 // then pass data via socket
-void readClientIO( int socket ){
+void readClientIO( int socket, int nick ){
 	char data[MAX_LEN];
 
 	while ((fgets( data, MAX_LEN, stdin) != NULL ) 
@@ -225,24 +375,42 @@ void readClientIO( int socket ){
 		filterData(  data, MAX_LEN );				
 		
 		// push data to socket
-		if(bulk_write(socket, data,MAX_LEN) < 0) ERR("write:");		
+		if (PROTO_BINARY == proto){
+			sendLine(socket, data, nick);
+		} else if(bulk_write(socket, data,MAX_LEN) < 0) ERR("write:");		
+		nick = 0;
+	}
+}
+
+// answers nickname prompt with resume token
+void sendResume(int socket){
+	char data[MAX_LEN];
+	if (PROTO_BINARY == proto){
+		sendMsg(socket, MSG_RESUME, resume, strlen(resume));
+		return;
 	}
+	memset(data, 0, MAX_LEN);
+	snprintf(data, MAX_LEN, "/resume %s", resume);
+	if(bulk_write(socket, data, MAX_LEN) < 0) ERR("write:");
 }
 
 // initial game settings
 void gameInit(int socket){
 	char line[MAX_LEN];
-	int size;	
+	int type;	
 	fprintf(stderr,"Waiting for other players to connect.\n");	
-	if(((size = bulk_read(socket,line,MAX_LEN)) < 0) 
-		|| (MAX_LEN != size) 
-		|| (0 == line[0])  ){	
+	if(((type = readFrame(socket, line)) < 0) 
+		|| (MSG_END == type) ){	
 		
 		if (do_work && safe_close(socket)<0) ERR("close");			
 		
 		return;
 	}		
 	fprintf(stderr,"%s\n", line );	
+	if (NULL != resume){
+		sendResume(socket);
+		return;
+	}
 	fprintf(stderr,"Enter your nickname:\n");
 }
 
@@ -256,7 +424,7 @@ void mainClientProcess(int socket){
 		
 			// child proccess
 			case 0:		
-				readClientIO( socket );
+				readClientIO( socket, NULL == resume );
 				safe_close( socket );
 				exit(EXIT_SUCCESS);
 			
@@ -273,8 +441,27 @@ void mainClientProcess(int socket){
 }
 
 int main(int argc, char** argv){	
+	char* path = NULL;
+	int opt;
+
 	// check input
-	if (argc != 3) {
+	while(-1 != (opt = getopt(argc, argv, "br:u:"))){
+		switch(opt){
+			case 'b':
+				proto = PROTO_BINARY;
+				break;
+			case 'r':
+				resume = optarg;
+				break;
+			case 'u':
+				path = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != (NULL == path ? 2 : 0)) {
 		usage(argv[0]);
 		return EXIT_FAILURE;
 	}	
@@ -286,8 +473,18 @@ int main(int argc, char** argv){
 	if(sethandler(sigint_handler,SIGINT)) ERR("Seting SIGINT:");
 	
 	// establish connection
-	socket_descriptor = connect_socket(argv[1],atoi(argv[2]));	
+	if (NULL == path){
+		socket_descriptor = connect_socket(argv[optind],atoi(argv[optind + 1]));	
+	} else {
+		socket_descriptor = connect_unix_socket(path);
+	}
+	if (PROTO_BINARY == proto){
+		sendHello(socket_descriptor);
+	}
 	
+	// empty board for deltas
+	memset(board, '-', sizeof(board));
+
 	// handle logic
 	mainClientProcess(socket_descriptor);
 		
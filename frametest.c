@@ -0,0 +1,357 @@
+// frame decoding tests, make test runs them with address sanitizer
+//
+// server.c is compiled in with its main renamed, frames are written to one end
+// of socket pair and read by reactor connection on the other end, the same way
+// client frames are
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <sys/socket.h>
+
+// full socket may take any part of nonblocking send, tests make it happen often
+ssize_t testSend(int fd, const void* buf, size_t len, int flags){
+	if((MSG_DONTWAIT & flags) && len > 1){
+		len = 1 + rand() % len;
+	}
+	return send(fd, buf, len, flags);
+}
+
+#define main serverMain
+#define send testSend
+#include "server.c"
+#undef send
+#undef main
+
+// random boards checked against line table
+#define GAME_RANDOM 200000
+
+// forked chat test sizes
+#define FORK_MOVES 3000
+#define FORK_CHATS 3000
+#define FORK_INPUT (4 << 20)
+#define FORK_READ 48
+
+int failures = 0;
+
+// reports failed condition and keeps going
+#define CHECK(cond) do { \
+	if(!(cond)){ \
+		fprintf(stderr, "FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+} while(0)
+
+// reactor player reading from socket pair, returns the end its client writes to
+// and sets socket to the one reactor reads
+int testPlayer(int proto, char* name, int* socket){
+	int sv[2], num;
+	if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv)) ERR("socketpair");
+	if(connOpen(sv[0])) ERR("connOpen");
+	if(-1 == (num = addPlayer(sv[0]))) ERR("addPlayer");
+	conns[sv[0]]->playerId = num;
+	conns[sv[0]]->phase = CONN_PLAYING;
+	player_array[num].proto = proto;
+	snprintf(player_info[num].name, sizeof(player_info[num].name), "%s", name);
+	*socket = sv[0];
+	return sv[1];
+}
+
+// last chat entry as text
+char* lastChat(){
+	return chat->entries[(chat->head - 1) % CHAT_RING].frame + PROTO_HEADER;
+}
+
+// every winning line of 5x5 board as cells
+int win_lines[][5] = {
+	{0, 1, 2, 3, 4}, {5, 6, 7, 8, 9}, {10, 11, 12, 13, 14}, {15, 16, 17, 18, 19}, {20, 21, 22, 23, 24},
+	{0, 5, 10, 15, 20}, {1, 6, 11, 16, 21}, {2, 7, 12, 17, 22}, {3, 8, 13, 18, 23}, {4, 9, 14, 19, 24},
+	{0, 6, 12, 18, 24}, {4, 8, 12, 16, 20},
+};
+
+// five cells in a row only when counted across board edge
+int edge_lines[][5] = {
+	{3, 4, 5, 6, 7}, {4, 5, 6, 7, 8}, {9, 10, 11, 12, 13}, {19, 20, 21, 22, 23},
+	{1, 7, 13, 19, 20}, {5, 11, 17, 23, 4}, {3, 7, 11, 15, 19}, {5, 9, 13, 17, 21},
+	{2, 6, 10, 14, 18}, {0, 4, 8, 12, 16},
+};
+
+#define LINES(t) ((int)(sizeof(t) / sizeof(t[0])))
+
+uint64_t lineCells(int* line){
+	uint64_t cells = 0;
+	int i;
+	for(i = 0; i < 5; i++){
+		cells |= 1ULL << line[i];
+	}
+	return cells;
+}
+
+// plain scan of line table, bitboard rules must agree with it
+int refWinner(uint64_t cells, int move){
+	int i, j;
+	for(i = 0; i < LINES(win_lines); i++){
+		for(j = 0; j < 5 && win_lines[i][j] != move; j++);
+		if((-1 == move || j < 5) && (cells & lineCells(win_lines[i])) == lineCells(win_lines[i])){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// win detection for every line, cell taken last, line missing a cell,
+// lines wrapping over board edge and random boards
+void testGameRules(){
+	uint64_t cells;
+	int i, j, k;
+	for(i = 0; i < LINES(win_lines); i++){
+		cells = lineCells(win_lines[i]);
+		CHECK(isWinner(cells));
+		for(j = 0; j < 5; j++){
+			CHECK(isWinningMove(cells, win_lines[i][j]));
+			CHECK(!isWinner(cells & ~(1ULL << win_lines[i][j])));
+			CHECK(!isWinningMove(cells & ~(1ULL << win_lines[i][j]), win_lines[i][j]));
+		}
+
+		// complete line does not make unrelated move winning
+		for(k = 0; k < GAME_CELLS; k++){
+			if(!(cells & 1ULL << k)){
+				CHECK(refWinner(cells | 1ULL << k, k) == isWinningMove(cells | 1ULL << k, k));
+			}
+		}
+	}
+	for(i = 0; i < LINES(edge_lines); i++){
+		cells = lineCells(edge_lines[i]);
+		CHECK(!isWinner(cells));
+		for(j = 0; j < 5; j++){
+			CHECK(!isWinningMove(cells, edge_lines[i][j]));
+		}
+	}
+
+	// bits past last cell are never part of a line
+	CHECK(!isWinner(BOARD_FULL << GAME_CELLS));
+	CHECK(!isWinner(BOARD_ROW << GAME_CELLS));
+
+	srand(7);
+	for(i = 0; i < GAME_RANDOM; i++){
+		cells = ((uint64_t)rand() << 31 | rand()) & BOARD_FULL;
+		CHECK(refWinner(cells, -1) == isWinner(cells));
+		for(k = 0; k < GAME_CELLS; k++){
+			if(cells & 1ULL << k){
+				CHECK(refWinner(cells, k) == isWinningMove(cells, k));
+			}
+		}
+	}
+}
+
+// full board without line is tie, board with any cell free is not,
+// line made by last move wins even when it fills the board
+void testGameEnd(){
+	// X O X O X / X O X O X / O X O X O / X O X O X / X O X O X
+	uint64_t x = 0x15AAAB5ULL;
+	uint64_t o = BOARD_FULL & ~x;
+	uint64_t state;
+	int i;
+	CHECK(!isWinner(x));
+	CHECK(!isWinner(o));
+	state = x | o << GAME_O_SHIFT;
+	CHECK(isTie(state));
+	CHECK(2 == boardState(X, state, 0));
+	CHECK(2 == boardState(O, state, 1));
+	for(i = 0; i < GAME_CELLS; i++){
+		state = (x & ~(1ULL << i)) | (o & ~(1ULL << i)) << GAME_O_SHIFT;
+		CHECK(!isTie(state));
+	}
+	CHECK(0 == boardState(X, (x & ~(1ULL << 24)) | o << GAME_O_SHIFT, 22));
+
+	// last free cell completes first row for X
+	state = (x | BOARD_ROW) | (o & ~BOARD_ROW) << GAME_O_SHIFT;
+	CHECK(1 == boardState(X, state, 1));
+}
+
+// game records stay one per cache line, move times live in separate array
+void testGameLayout(){
+	CHECK(64 == sizeof(game_struct));
+}
+
+// binary frames of every text type with longest payload header allows
+void testBinaryLimits(){
+	char payload[PROTO_MAX_PAYLOAD];
+	int types[] = {MSG_NICK, MSG_CHAT, MSG_CHATALL, MSG_ROOM, MSG_JOIN, MSG_LEAVE, MSG_RESUME};
+	msg_struct m;
+	int i;
+	memset(payload, 'x', sizeof(payload));
+	for(i = 0; i < sizeof(types) / sizeof(types[0]); i++){
+		memset(&m, 'y', sizeof(m));
+		CHECK(1 == msgBinary(types[i], payload, sizeof(payload), &m));
+		CHECK(strnlen(m.text, MAX_LEN) < MAX_LEN);
+	}
+}
+
+// maximum length chat all frame sent by binary client reaches chat ring cut to legacy frame
+void testBinaryChatAll(){
+	char frame[PROTO_HEADER + PROTO_MAX_PAYLOAD];
+	uint64_t head = chat->head;
+	int socket;
+	int client = testPlayer(PROTO_BINARY, "bin", &socket);
+	frame[0] = MSG_CHATALL;
+	frame[1] = (char)PROTO_MAX_PAYLOAD;
+	memset(frame + PROTO_HEADER, 'b', PROTO_MAX_PAYLOAD);
+	CHECK(sizeof(frame) == write(client, frame, sizeof(frame)));
+	connRead(socket);
+	CHECK(head + 1 == chat->head);
+	CHECK(0 == strncmp(lastChat(), "[bin]: @bbb", 11));
+	CHECK(MAX_LEN - 1 == strlen(lastChat()));
+	CHECK(0 == conns[socket]->inlen);
+	if(safe_close(client) < 0) ERR("close");
+}
+
+// maximum length legacy chat all frame without terminating nul
+void testLegacyChatAll(){
+	char frame[MAX_LEN];
+	uint64_t head = chat->head;
+	int socket;
+	int client = testPlayer(PROTO_LEGACY, "leg", &socket);
+	memset(frame, 'l', MAX_LEN);
+	frame[0] = '@';
+	CHECK(MAX_LEN == write(client, frame, MAX_LEN));
+	connRead(socket);
+	CHECK(head + 1 == chat->head);
+	CHECK(0 == strncmp(lastChat(), "[leg]: @lll", 11));
+	CHECK(MAX_LEN - 1 == strlen(lastChat()));
+	if(safe_close(client) < 0) ERR("close");
+}
+
+// reader taking less than queued keeps socket full, output buffer must not
+// keep growing while watermarks hold pending bytes steady
+void testPartialDrain(){
+	char frame[MAX_LEN], buf[MAX_LEN * 4];
+	int socket, size = 4096, i, partial = 0;
+	int client = testPlayer(PROTO_LEGACY, "slow", &socket);
+	conn_struct* c = conns[socket];
+	if(setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size))) ERR("setsockopt");
+	memset(frame, 'q', MAX_LEN);
+	for(i = 0; i < 20000; i++){
+		while(c->outlen - c->outoff < MAX_LEN * 32){
+			connQueue(socket, frame, MAX_LEN);
+		}
+		connFlush(socket);
+		partial += c->outoff > 0;
+		if(read(client, buf, sizeof(buf)) < 0 && EAGAIN != errno) ERR("read");
+	}
+	CHECK(partial > 0);
+	CHECK(c->outcap <= MAX_LEN * 64);
+	connFlushQueued();
+	if(safe_close(client) < 0) ERR("close");
+}
+
+// length of stream prefix made of whole frames forked test sends, counts them
+int forkedFrames(char* in, ssize_t n, int* moves, int* chats){
+	char text[MAX_LEN], expected[MAX_LEN];
+	int pos, len;
+	for(pos = 0; pos + PROTO_HEADER <= n; pos += PROTO_HEADER + len){
+		len = (unsigned char)in[pos + 1];
+		if(pos + PROTO_HEADER + len > n){
+			break;
+		}
+		snprintf(text, MAX_LEN, "%.*s", len, in + pos + PROTO_HEADER);
+		snprintf(expected, MAX_LEN, "move %d", *moves);
+		if(MSG_TEXT == (unsigned char)in[pos] && 0 == strcmp(text, expected)){
+			(*moves)++;
+		} else if(MSG_CHATALL == (unsigned char)in[pos] && 0 == strncmp(text, "chat ", 5)){
+			(*chats)++;
+		} else {
+			break;
+		}
+	}
+	return pos;
+}
+
+// forked mode: player process writes game frames while broadcaster pushes chat
+// to same full socket, binary stream read slowly must stay in whole frames
+void testForkedChatFrames(){
+	char text[MAX_LEN], *in;
+	int sv[2], num, status, i, moves = 0, chats = 0, size = 4096, done = 0;
+	ssize_t n = 0, len;
+	pid_t pid;
+
+	reactor_mode = 0;
+	if(NULL == (in = malloc(FORK_INPUT))) ERR("malloc");
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) ERR("socketpair");
+	send_limit(sv[0]);
+	if(setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size))) ERR("setsockopt");
+	if(fcntl(sv[1], F_SETFL, O_NONBLOCK)) ERR("fcntl");
+	if(-1 == (num = addPlayer(sv[0]))) ERR("addPlayer");
+	player_array[num].proto = PROTO_BINARY;
+
+	// player process sends its moves with blocking writes like in a game
+	switch(pid = fork()){
+		case 0:
+			for(i = 0; i < FORK_MOVES; i++){
+				snprintf(text, MAX_LEN, "move %d", i);
+				sendText(sv[0], text);
+			}
+			_exit(EXIT_SUCCESS);
+		case -1:
+			ERR("fork");
+	}
+
+	// chat lengths vary and reader is slower than both writers
+	for(i = 0; !done || i < FORK_CHATS || chat_cursor[num] != chat->head || chat_tail_len[num]; i++){
+		if(i < FORK_CHATS){
+			snprintf(text, MAX_LEN, "chat %d %0*d", i, i % 97, 0);
+			chatPublish(MSG_CHATALL, "", num, text);
+		}
+		chatDeliver(num);
+		if(n + FORK_READ > FORK_INPUT){
+			break;
+		}
+		if((len = read(sv[1], in + n, FORK_READ)) > 0){
+			n += len;
+		} else if(len < 0 && EAGAIN != errno){
+			ERR("read");
+		}
+		if(!done && pid == waitpid(pid, &status, WNOHANG)){
+			done = 1;
+		}
+	}
+	while(n < FORK_INPUT && (len = read(sv[1], in + n, FORK_INPUT - n)) > 0){
+		n += len;
+	}
+
+	CHECK(n == forkedFrames(in, n, &moves, &chats));
+	CHECK(FORK_MOVES == moves);
+	CHECK(chats > 0);
+
+	removePlayer(num);
+	if(safe_close(sv[1]) < 0) ERR("close");
+	free(in);
+	reactor_mode = 1;
+}
+
+int main(int argc, char** argv){
+	reactor_mode = 1;
+	player_capacity = INDEX_CHUNK;
+	chatInit();
+	sharedMemoryInit();
+	setupplayer_array();
+	if(pipe2(pipes, O_NONBLOCK)) ERR("pipe");
+	if(-1 == (epollfd = epoll_create1(EPOLL_CLOEXEC))) ERR("epoll_create1");
+
+	testGameLayout();
+	testGameRules();
+	testGameEnd();
+	testBinaryLimits();
+	testBinaryChatAll();
+	testLegacyChatAll();
+	testPartialDrain();
+	testForkedChatFrames();
+
+	removeSharedMem();
+	arenaFree(&chat_arena);
+	if(failures){
+		fprintf(stderr, "%d checks failed\n", failures);
+		return EXIT_FAILURE;
+	}
+	fprintf(stderr, "frame tests passed\n");
+	return EXIT_SUCCESS;
+}
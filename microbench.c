@@ -0,0 +1,368 @@
+// micro benchmarks of server and client hot paths
+//
+// server.c is compiled in with its main renamed, so routines are measured
+// exactly as server build has them. client filterData comes from client.c
+// object that keeps only that symbol global, see makefile.
+
+#define main serverMain
+#include "server.c"
+#undef main
+
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// generated inputs, routines walk them in a loop
+#define INPUTS 4096
+#define BENCH_PLAYERS 16384
+#define BENCH_SOCKET 1000
+#define BENCH_PID 100000
+
+// cycle counter sources
+#define CYCLES_NONE 0
+#define CYCLES_PERF 1
+#define CYCLES_TSC 2
+
+void filterData(char*, int);
+
+// BENCH_STRUCT - one measured routine, run does given number of operations
+// and returns value depending on all of them so no work can be skipped
+typedef struct {
+
+	char* name;
+	uint64_t (*run)(long);
+
+	// median and best ns per operation, median cycles per operation
+	double ns, best, cycles;
+
+} bench_struct;
+
+// POSITION_STRUCT - game state after random moves and the last of them
+typedef struct {
+
+	uint64_t state;
+	int move;
+	char symbol;
+
+} position_struct;
+
+position_struct positions[INPUTS];
+char boards[INPUTS][GAME_CELLS + 1];
+char frames[INPUTS][MAX_LEN];
+char lines[INPUTS][MAX_LEN];
+int sockets[INPUTS];
+pid_t pids[INPUTS];
+
+int cycles_source = CYCLES_NONE;
+int perf_fd = -1;
+
+void benchUsage(char* name){
+	fprintf(stderr,"USAGE: %s [-n OPS] [-r REPS] [-f NAME] [-b BASELINE]\n",name);
+	fprintf(stderr,"\t-n OPS\toperations per repetition, default 1000000\n");
+	fprintf(stderr,"\t-r REPS\trepetitions after warm-up, median is reported, default 5\n");
+	fprintf(stderr,"\t-f NAME\tonly run routines whose name contains NAME\n");
+	fprintf(stderr,"\t-b BASELINE\tcompare with output of other build saved in file\n");
+}
+
+// plays random legal moves, some positions end with won game
+void positionsInit(){
+	uint64_t cell;
+	int i, j, n, move;
+	char symbol;
+	for(i = 0; i < INPUTS; i++){
+		positions[i].state = 0;
+		positions[i].move = 0;
+		positions[i].symbol = X;
+		n = 1 + rand() % GAME_CELLS;
+		for(j = 0; j < n; j++){
+			do {
+				move = rand() % GAME_CELLS;
+				cell = 1ULL << move;
+			} while((GAME_X_CELLS(positions[i].state) | GAME_O_CELLS(positions[i].state)) & cell);
+			symbol = gameTurn(positions[i].state);
+			positions[i].state = (positions[i].state | (X == symbol ? cell : cell << GAME_O_SHIFT)) ^ GAME_TURN_BIT;
+			positions[i].move = move;
+			positions[i].symbol = symbol;
+			if(isWinningMove(X == symbol ? GAME_X_CELLS(positions[i].state) : GAME_O_CELLS(positions[i].state), move)){
+				break;
+			}
+		}
+		gameBoard(positions[i].state, boards[i]);
+	}
+}
+
+// legacy frames of every kind players send
+void framesInit(){
+	int i;
+	for(i = 0; i < INPUTS; i++){
+		memset(frames[i], 0, MAX_LEN);
+		switch(i % 6){
+			case 0:
+				snprintf(frames[i], MAX_LEN, "%02d", rand() % GAME_CELLS);
+				break;
+			case 1:
+				snprintf(frames[i], MAX_LEN, "@hello everybody %d", i);
+				break;
+			case 2:
+				snprintf(frames[i], MAX_LEN, "#room%d good game", i % 10);
+				break;
+			case 3:
+				snprintf(frames[i], MAX_LEN, "/join room%d", i % 10);
+				break;
+			case 4:
+				snprintf(frames[i], MAX_LEN, "/leave room%d", i % 10);
+				break;
+			default:
+				snprintf(frames[i], MAX_LEN, "nice move, my turn %d", i);
+		}
+		memset(lines[i], 'a' + i % 26, MAX_LEN);
+		lines[i][i % (MAX_LEN - 1)] = '\n';
+		lines[i][MAX_LEN - 1] = '\0';
+	}
+}
+
+// player table of the accepting process with random lookups
+void tablesInit(){
+	int i, num;
+	player_capacity = BENCH_PLAYERS;
+	chatInit();
+	sharedMemoryInit();
+	setupplayer_array();
+	for(i = 0; i < BENCH_PLAYERS; i++){
+		num = slotAlloc();
+		socketMapPut(BENCH_SOCKET + i, num);
+		pidMapPut(BENCH_PID + i * 7, num);
+	}
+	for(i = 0; i < INPUTS; i++){
+		sockets[i] = BENCH_SOCKET + rand() % BENCH_PLAYERS;
+		pids[i] = BENCH_PID + rand() % BENCH_PLAYERS * 7;
+	}
+}
+
+uint64_t runIsWinner(long n){
+	uint64_t sum = 0;
+	long i;
+	for(i = 0; i < n; i++){
+		sum += isWinner(GAME_X_CELLS(positions[i % INPUTS].state));
+	}
+	return sum;
+}
+
+uint64_t runBoardState(long n){
+	position_struct* p;
+	uint64_t sum = 0;
+	long i;
+	for(i = 0; i < n; i++){
+		p = &positions[i % INPUTS];
+		sum += boardState(p->symbol, p->state, p->move);
+	}
+	return sum;
+}
+
+uint64_t runGameBoard(long n){
+	char board[GAME_CELLS + 1];
+	uint64_t sum = 0;
+	long i;
+	for(i = 0; i < n; i++){
+		gameBoard(positions[i % INPUTS].state, board);
+		sum += board[i % GAME_CELLS];
+	}
+	return sum;
+}
+
+uint64_t runGetMsgType(long n){
+	uint64_t sum = 0;
+	long i;
+	for(i = 0; i < n; i++){
+		sum += getMsgType(frames[i % INPUTS]);
+	}
+	return sum;
+}
+
+// socket is not in player table, so board is rendered as legacy text frames
+// and queued nowhere, only formatting is measured
+uint64_t runSendBoard(long n){
+	long i;
+	for(i = 0; i < n; i++){
+		sendBoard(-1 - i % INPUTS, boards[i % INPUTS]);
+	}
+	return n;
+}
+
+uint64_t runFilterData(long n){
+	uint64_t sum = 0;
+	long i;
+	for(i = 0; i < n; i++){
+		filterData(lines[i % INPUTS], MAX_LEN);
+		sum += lines[i % INPUTS][0];
+	}
+	return sum;
+}
+
+uint64_t runGetBySocket(long n){
+	uint64_t sum = 0;
+	long i;
+	for(i = 0; i < n; i++){
+		sum += getBySocket(sockets[i % INPUTS]);
+	}
+	return sum;
+}
+
+uint64_t runGetByPID(long n){
+	uint64_t sum = 0;
+	long i;
+	for(i = 0; i < n; i++){
+		sum += getByPID(pids[i % INPUTS]);
+	}
+	return sum;
+}
+
+bench_struct benches[] = {
+	{"isWinner", runIsWinner},
+	{"boardState", runBoardState},
+	{"gameBoard", runGameBoard},
+	{"getMsgType", runGetMsgType},
+	{"sendBoard", runSendBoard},
+	{"filterData", runFilterData},
+	{"getBySocket", runGetBySocket},
+	{"getByPID", runGetByPID},
+};
+
+// counts cycles of this thread with perf events, time stamp counter otherwise
+void cyclesInit(){
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	if(-1 != (perf_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0))){
+		cycles_source = CYCLES_PERF;
+		return;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	cycles_source = CYCLES_TSC;
+#endif
+}
+
+uint64_t cyclesNow(){
+	uint64_t count = 0;
+	switch(cycles_source){
+		case CYCLES_PERF:
+			if(sizeof(count) != read(perf_fd, &count, sizeof(count))) ERR("read");
+			return count;
+#if defined(__x86_64__) || defined(__i386__)
+		case CYCLES_TSC:
+			return __rdtsc();
+#endif
+	}
+	return 0;
+}
+
+int doubleCompare(const void* a, const void* b){
+	double x = *(double*)a, y = *(double*)b;
+	return x < y ? -1 : x > y;
+}
+
+// warms routine up and keeps median of repetitions
+void benchRun(bench_struct* b, long ops, int reps, uint64_t* sink){
+	double ns[reps], cycles[reps];
+	uint64_t c;
+	int64_t t;
+	int i;
+
+	*sink += b->run(ops / 10 + 1);
+	for(i = 0; i < reps; i++){
+		t = monotonicUs();
+		c = cyclesNow();
+		*sink += b->run(ops);
+		cycles[i] = (double)(cyclesNow() - c) / ops;
+		ns[i] = (monotonicUs() - t) * 1000.0 / ops;
+	}
+	qsort(ns, reps, sizeof(double), doubleCompare);
+	qsort(cycles, reps, sizeof(double), doubleCompare);
+	b->ns = ns[reps / 2];
+	b->best = ns[0];
+	b->cycles = cycles[reps / 2];
+}
+
+// ns per op of routine in baseline output, 0 if it is not there
+double baselineNs(char* path, char* name){
+	char line[MAX_LEN], routine[64];
+	double ns = 0, value;
+	FILE* f;
+	if(NULL == (f = fopen(path, "r"))) ERR("fopen");
+	while(NULL != fgets(line, sizeof(line), f)){
+		if('#' != line[0] && 2 == sscanf(line, "%63s %lf", routine, &value) && 0 == strcmp(routine, name)){
+			ns = value;
+		}
+	}
+	if(fclose(f)) ERR("fclose");
+	return ns;
+}
+
+int main(int argc, char** argv){
+	char* sources[] = {"none", "perf", "tsc"};
+	char* filter = NULL;
+	char* baseline = NULL;
+	long ops = 1000000;
+	int reps = 5;
+	uint64_t sink = 0;
+	double base;
+	int opt, i;
+
+	while(-1 != (opt = getopt(argc, argv, "n:r:f:b:"))){
+		switch(opt){
+			case 'n':
+				ops = atol(optarg);
+				break;
+			case 'r':
+				reps = atoi(optarg);
+				break;
+			case 'f':
+				filter = optarg;
+				break;
+			case 'b':
+				baseline = optarg;
+				break;
+			default:
+				benchUsage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if(argc != optind || ops < 1 || reps < 1){
+		benchUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// boards are only formatted, never written
+	reactor_mode = 1;
+	srand(1);
+	positionsInit();
+	framesInit();
+	tablesInit();
+	cyclesInit();
+
+	printf("# %ld ops, %d reps, cycles from %s\n", ops, reps, sources[cycles_source]);
+	printf("# routine\tns/op\tbest\tcycles/op%s\n", baseline ? "\tbase\tchange" : "");
+	for(i = 0; i < sizeof(benches) / sizeof(benches[0]); i++){
+		if(NULL != filter && NULL == strstr(benches[i].name, filter)){
+			continue;
+		}
+		benchRun(&benches[i], ops, reps, &sink);
+		printf("%s\t%.2f\t%.2f\t%.1f", benches[i].name, benches[i].ns, benches[i].best, benches[i].cycles);
+		if(baseline && (base = baselineNs(baseline, benches[i].name)) > 0){
+			printf("\t%.2f\t%+.1f%%", base, (benches[i].ns - base) * 100 / base);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	// keeps results alive
+	fprintf(stderr, "checksum %" PRIu64 "\n", sink);
+	removeSharedMem();
+	arenaFree(&chat_arena);
+	return EXIT_SUCCESS;
+}
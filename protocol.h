@@ -0,0 +1,73 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+// binary protocol shared by client and server
+//
+// legacy peers exchange fixed MAX_LEN text frames, first byte of such frame
+// is always below 0x80. binary frames are 2 byte header followed by payload:
+//	byte 0 - message type, always has 0x80 bit set
+//	byte 1 - payload length 0-255
+// so binary client can read stream mixing both kinds of frames.
+//
+// client switches to binary by sending PROTO_HELLO as its very first frame,
+// 0xFF never starts a legacy frame as it is not valid in UTF-8 text.
+// server keeps talking legacy frames to it until hello is read.
+
+#define PROTO_LEGACY 0
+#define PROTO_BINARY 1
+
+#define PROTO_HEADER 2
+#define PROTO_MAX_PAYLOAD 255
+#define PROTO_MAGIC "TTT1"
+
+// message types
+#define PROTO_HELLO 0xFF
+
+// server text line, nickname prompt and waiting info
+#define MSG_TEXT 0x81
+
+// client nickname
+#define MSG_NICK 0x82
+
+// client move, payload is single byte cell number 0-24
+#define MSG_MOVE 0x83
+
+// private chat, client sends text, server sends "[nick]: text"
+#define MSG_CHAT 0x84
+
+// chat to all, same payloads as MSG_CHAT
+#define MSG_CHATALL 0x85
+
+// whole board, payload is 25 cell symbols
+#define MSG_BOARD 0x86
+
+// game result line
+#define MSG_RESULT 0x87
+
+// end of transmission, server closes connection after it
+#define MSG_END 0x88
+
+// single cell change after move, payload is cell, symbol and number of
+// taken cells. client starts with empty board and applies deltas to it
+#define MSG_DELTA 0x89
+
+// join and leave chat room, payload is room name
+#define MSG_JOIN 0x8A
+#define MSG_LEAVE 0x8B
+
+// chat to room, client sends "room text", server sends "[nick] #room: text"
+#define MSG_ROOM 0x8C
+
+// resume token of epoll server started with -r, sent after nickname,
+// payload is token as 16 hex digits
+#define MSG_SESSION 0x8D
+
+// client reattaches to game of its dropped connection, sent instead of MSG_NICK
+// with MSG_SESSION payload, legacy clients answer nickname prompt with
+// "/resume TOKEN". server asks for nickname again if session is unknown
+#define MSG_RESUME 0x8E
+
+// tells if first byte of frame starts binary frame
+#define PROTO_IS_BINARY(b) ((unsigned char)(b) & 0x80)
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+
+// binary game records shared by server and stats tool
+//
+// record file starts with record_header_struct followed by fixed size
+// record_struct entries in host byte order. server only appends whole
+// records to it, so reader may map file while it grows and use every
+// complete record it sees.
+
+#define RECORD_FILE "games.dat"
+#define RECORD_MAGIC "TTTG"
+#define RECORD_VERSION 2
+
+#define RECORD_NAME 64
+#define RECORD_CELLS 25
+
+// game results
+#define RESULT_X 0
+#define RESULT_O 1
+#define RESULT_TIE 2
+#define RESULT_ABANDONED 3
+
+// RECORD_HEADER_STRUCT - start of record file
+typedef struct {
+
+	// RECORD_MAGIC without nul, RECORD_VERSION and size of one record
+	char magic[4];
+	uint32_t version, size;
+
+	uint32_t reserved;
+
+} record_header_struct;
+
+// RECORD_STRUCT - one finished game
+typedef struct {
+
+	// unix time game ended
+	int64_t time;
+
+	// final X and O cell sets, bit n is cell n
+	uint32_t x_cells, o_cells;
+
+	// nul terminated nicknames of X and O player
+	char x_name[RECORD_NAME], o_name[RECORD_NAME];
+
+	// RESULT_X, RESULT_O, RESULT_TIE or RESULT_ABANDONED and number of moves
+	uint8_t result, moves_len;
+
+	// cells in order of moves, X moves first
+	uint8_t moves[RECORD_CELLS];
+
+	uint8_t pad[5];
+
+	// unix time players were paired in microseconds and time of each move
+	// since then, replay uses them to send moves at recorded pace
+	int64_t start_us;
+	uint32_t move_us[RECORD_CELLS];
+
+	uint8_t reserved[36];
+
+} record_struct;
+
+_Static_assert(sizeof(record_struct) == 320, "record layout changed");
+
+#endif
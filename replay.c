@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <netdb.h>
+#include "protocol.h"
+#include "record.h"
+#define ERR(source) (perror(source),\
+		     fprintf(stderr,"%s:%d\n",__FILE__,__LINE__),\
+		     exit(EXIT_FAILURE))
+#define HERR(source) (fprintf(stderr,"%s(%d) at %s:%d\n",source,h_errno,__FILE__,__LINE__),\
+		     exit(EXIT_FAILURE))
+
+#define MAX_LEN 256
+#define MAX_EVENTS 256
+
+// replayed game phases
+#define REPLAY_NAMING 0
+#define REPLAY_PLAYING 1
+#define REPLAY_DONE 2
+
+// REPLAY_STRUCT - recorded game fed back to server by two connections
+typedef struct {
+
+	record_struct* record;
+
+	// X and O sockets, -1 once closed
+	int x, o;
+
+	// REPLAY_NAMING until X gets its board, number of moves sent
+	int phase, sent;
+
+	// moves server confirmed and result it reported
+	int taken, won, tie;
+
+} replay_struct;
+
+// CONN_STRUCT - frame being read from one connection
+typedef struct {
+
+	int game;
+
+	// legacy frame is the longest one
+	char in[PROTO_HEADER + PROTO_MAX_PAYLOAD];
+	size_t inlen;
+
+} conn_struct;
+
+// TIMER_STRUCT - move due at given time after replay start
+typedef struct {
+
+	int64_t due;
+	int game;
+
+} timer_struct;
+
+volatile sig_atomic_t do_work=1;
+
+char* host;
+uint16_t port;
+double speed = 1;
+int epollfd;
+
+replay_struct* games;
+int games_len, games_done = 0;
+int64_t first_us;
+
+conn_struct** conns = NULL;
+int conns_size = 0;
+
+// binary heap of timers ordered by due time
+timer_struct* timers;
+int timers_len = 0;
+
+void sigint_handler(int sig){
+	do_work = 0;
+}
+
+int sethandler( void (*f)(int), int sigNo){
+	struct sigaction act;
+	memset(&act, 0, sizeof(struct sigaction));
+	act.sa_handler = f;
+	if (-1==sigaction(sigNo, &act, NULL))
+		return -1;
+	return 0;
+}
+
+void usage(char* name){
+	fprintf(stderr,"USAGE: %s [-s SPEED] [-f FILE] HOST PORT\n",name);
+	fprintf(stderr,"\t-s SPEED\treplay SPEED times faster than recorded, default 1\n");
+	fprintf(stderr,"\t-f FILE\trecord file, default %s\n",RECORD_FILE);
+	fprintf(stderr,"games are paired in connection order, use unsharded server\n");
+}
+
+// monotonic time in microseconds
+int64_t nowUs(){
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0) ERR("clock_gettime");
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+ssize_t bulk_write(int fd, char *buf, size_t count){
+	int c;
+	size_t len=0;
+	do{
+		c=TEMP_FAILURE_RETRY(write(fd,buf,count));
+		if(c<0) return c;
+		buf+=c;
+		len+=c;
+		count-=c;
+	}while(count>0);
+	return len ;
+}
+
+struct sockaddr_in make_address(char *address, uint16_t port){
+	struct sockaddr_in addr;
+	struct hostent *hostinfo;
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (port);
+	hostinfo = gethostbyname(address);
+	if(NULL == hostinfo) HERR("gethostbyname");
+	addr.sin_addr = *(struct in_addr*) hostinfo->h_addr;
+	return addr;
+}
+
+// connects blocking socket, connections are accepted in order they are made
+int connect_socket(char *name, uint16_t port){
+	struct sockaddr_in addr = make_address(name, port);
+	int socketfd;
+	if(-1 == (socketfd = socket(PF_INET, SOCK_STREAM, 0))) ERR("socket");
+	if(TEMP_FAILURE_RETRY(connect(socketfd, (struct sockaddr*) &addr, sizeof(struct sockaddr_in))) < 0) ERR("connect");
+	return socketfd;
+}
+
+void sendMsg(int socket, int type, char* data, int len){
+	char frame[MAX_LEN + PROTO_HEADER];
+	frame[0] = type;
+	frame[1] = len;
+	memcpy(frame + PROTO_HEADER, data, len);
+	if(bulk_write(socket, frame, PROTO_HEADER + len) < 0 && EPIPE != errno && ECONNRESET != errno) ERR("write");
+}
+
+// maps record file read only, returns first record and sets their number
+record_struct* mapRecords(char* path, int* count){
+	record_header_struct* header;
+	struct stat st;
+	char* base;
+	int fd;
+
+	if(-1 == (fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY)))) ERR("open");
+	if(fstat(fd, &st) < 0) ERR("fstat");
+	if(st.st_size < sizeof(record_header_struct)){
+		fprintf(stderr, "%s: not a record file\n", path);
+		exit(EXIT_FAILURE);
+	}
+	if(MAP_FAILED == (base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))) ERR("mmap");
+	if(close(fd) < 0) ERR("close");
+
+	header = (record_header_struct*)base;
+	if(memcmp(header->magic, RECORD_MAGIC, sizeof(header->magic))
+		|| RECORD_VERSION != header->version
+		|| sizeof(record_struct) != header->size){
+		fprintf(stderr, "%s: unknown record format\n", path);
+		exit(EXIT_FAILURE);
+	}
+	*count = (st.st_size - sizeof(record_header_struct)) / sizeof(record_struct);
+	return (record_struct*)(base + sizeof(record_header_struct));
+}
+
+// orders games by pairing time
+int gameCompare(const void* a, const void* b){
+	int64_t d = ((replay_struct*)a)->record->start_us - ((replay_struct*)b)->record->start_us;
+	return d < 0 ? -1 : d > 0;
+}
+
+// time after replay start when recorded event happens
+int64_t replayDue(int64_t us){
+	return (us - first_us) / speed;
+}
+
+void timerPush(int64_t due, int game){
+	int i = timers_len++;
+	timer_struct t = {due, game};
+	while(i > 0 && timers[(i - 1) / 2].due > due){
+		timers[i] = timers[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	timers[i] = t;
+}
+
+timer_struct timerPop(){
+	timer_struct top = timers[0];
+	timer_struct last = timers[--timers_len];
+	int i = 0, child;
+	while((child = 2 * i + 1) < timers_len){
+		if(child + 1 < timers_len && timers[child + 1].due < timers[child].due){
+			child++;
+		}
+		if(last.due <= timers[child].due){
+			break;
+		}
+		timers[i] = timers[child];
+		i = child;
+	}
+	timers[i] = last;
+	return top;
+}
+
+// watches connection of given game
+void connOpen(int socket, int game){
+	struct epoll_event ev;
+	int size = conns_size;
+	if(socket >= conns_size){
+		while(socket >= size){
+			size = size ? size * 2 : 1024;
+		}
+		if(NULL == (conns = realloc(conns, size * sizeof(conn_struct*)))) ERR("realloc");
+		memset(conns + conns_size, 0, (size - conns_size) * sizeof(conn_struct*));
+		conns_size = size;
+	}
+	if(NULL == (conns[socket] = calloc(1, sizeof(conn_struct)))) ERR("calloc");
+	conns[socket]->game = game;
+	ev.events = EPOLLIN;
+	ev.data.fd = socket;
+	if(-1 == epoll_ctl(epollfd, EPOLL_CTL_ADD, socket, &ev)) ERR("epoll_ctl");
+}
+
+// closes connection, -1 is ignored
+void connClose(int* socket){
+	if(-1 == *socket){
+		return;
+	}
+	free(conns[*socket]);
+	conns[*socket] = NULL;
+	if(TEMP_FAILURE_RETRY(close(*socket)) < 0) ERR("close");
+	*socket = -1;
+}
+
+// connects both players, X names itself first so it gets the X symbol
+void gameConnect(int num){
+	replay_struct* g = &games[num];
+	g->x = connect_socket(host, port);
+	g->o = connect_socket(host, port);
+	connOpen(g->x, num);
+	connOpen(g->o, num);
+	sendMsg(g->x, PROTO_HELLO, PROTO_MAGIC, strlen(PROTO_MAGIC));
+	sendMsg(g->o, PROTO_HELLO, PROTO_MAGIC, strlen(PROTO_MAGIC));
+	sendMsg(g->x, MSG_NICK, g->record->x_name, strnlen(g->record->x_name, RECORD_NAME - 1));
+	g->phase = REPLAY_NAMING;
+}
+
+// schedules move after last confirmed one, abandoned game ends with O leaving
+void gameNext(int num){
+	replay_struct* g = &games[num];
+	record_struct* r = g->record;
+	if(g->sent > g->taken || REPLAY_PLAYING != g->phase){
+		return;
+	}
+	if(g->sent < r->moves_len){
+		timerPush(replayDue(r->start_us + r->move_us[g->sent]), num);
+		g->sent++;
+	} else if(RESULT_ABANDONED == r->result){
+		connClose(&g->o);
+	}
+}
+
+// sends scheduled move, X makes even moves
+void gameMove(int num){
+	replay_struct* g = &games[num];
+	int k = g->sent - 1;
+	int socket = k % 2 ? g->o : g->x;
+	char cell = g->record->moves[k];
+	if(-1 != socket && REPLAY_PLAYING == g->phase){
+		sendMsg(socket, MSG_MOVE, &cell, 1);
+	}
+}
+
+void gameFinish(int num){
+	replay_struct* g = &games[num];
+	connClose(&g->x);
+	connClose(&g->o);
+	if(REPLAY_DONE != g->phase){
+		g->phase = REPLAY_DONE;
+		games_done++;
+	}
+}
+
+// tells if server ended game same way as recorded one
+int gameMatches(replay_struct* g){
+	switch(g->record->result){
+		case RESULT_X:
+		case RESULT_O:
+			return g->won && g->taken == g->record->moves_len;
+		case RESULT_TIE:
+			return g->tie && g->taken == g->record->moves_len;
+	}
+	return !g->won && !g->tie && g->taken == g->record->moves_len;
+}
+
+// handles frame from X, frames to O only need to be read
+void gameFrame(int num, int type, char* data, int len){
+	replay_struct* g = &games[num];
+	switch(type){
+		case MSG_BOARD:
+			if(REPLAY_NAMING == g->phase){
+				sendMsg(g->o, MSG_NICK, g->record->o_name, strnlen(g->record->o_name, RECORD_NAME - 1));
+				g->phase = REPLAY_PLAYING;
+				gameNext(num);
+			}
+			break;
+		case MSG_DELTA:
+			if(len >= 3){
+				g->taken = (unsigned char)data[2];
+				gameNext(num);
+			}
+			break;
+		case MSG_RESULT:
+			g->won = NULL != memmem(data, len, "wygral", 6);
+			g->tie = NULL != memmem(data, len, "remisuje", 8);
+			break;
+		case MSG_END:
+			gameFinish(num);
+			break;
+	}
+}
+
+// reads available data and handles every complete frame
+void connRead(int socket){
+	conn_struct* c = conns[socket];
+	replay_struct* g = &games[c->game];
+	size_t need;
+	ssize_t n;
+
+	n = TEMP_FAILURE_RETRY(read(socket, c->in + c->inlen, sizeof(c->in) - c->inlen));
+	if(n <= 0){
+		if(n < 0 && ECONNRESET != errno) ERR("read");
+		if(socket == g->x){
+			gameFinish(c->game);
+		} else {
+			connClose(&g->o);
+		}
+		return;
+	}
+	c->inlen += n;
+	for(;;){
+		need = PROTO_IS_BINARY(c->in[0]) ? PROTO_HEADER + (unsigned char)c->in[1] : MAX_LEN;
+		if(c->inlen < PROTO_HEADER || c->inlen < need){
+			return;
+		}
+		if(socket == g->x && PROTO_IS_BINARY(c->in[0])){
+			gameFrame(c->game, (unsigned char)c->in[0], c->in + PROTO_HEADER, need - PROTO_HEADER);
+
+			// game may have been finished and connection freed
+			if(socket != g->x){
+				return;
+			}
+		}
+		c->inlen -= need;
+		memmove(c->in, c->in + need, c->inlen);
+	}
+}
+
+// starts games and sends moves on time until every game ends
+void replay(){
+	struct epoll_event events[MAX_EVENTS];
+	int64_t start = nowUs(), now, due;
+	int next = 0, nfds, i, timeout;
+	timer_struct t;
+
+	while(do_work && games_done < games_len){
+		now = nowUs() - start;
+		while(next < games_len && replayDue(games[next].record->start_us) <= now){
+			gameConnect(next++);
+		}
+		while(timers_len > 0 && timers[0].due <= now){
+			t = timerPop();
+			gameMove(t.game);
+		}
+
+		// sleep until next game or move is due
+		due = -1;
+		if(next < games_len){
+			due = replayDue(games[next].record->start_us);
+		}
+		if(timers_len > 0 && (-1 == due || timers[0].due < due)){
+			due = timers[0].due;
+		}
+		timeout = -1 == due ? -1 : (due - now + 999) / 1000;
+		if(-1 == (nfds = epoll_wait(epollfd, events, MAX_EVENTS, timeout))){
+			if(EINTR == errno){
+				continue;
+			}
+			ERR("epoll_wait");
+		}
+		for(i = 0; i < nfds; i++){
+			if(events[i].data.fd < conns_size && NULL != conns[events[i].data.fd]){
+				connRead(events[i].data.fd);
+			}
+		}
+	}
+}
+
+int main(int argc, char** argv){
+	record_struct* records;
+	char* path = RECORD_FILE;
+	int64_t start, span = 0, end;
+	int opt, i, done, matched = 0;
+
+	while(-1 != (opt = getopt(argc, argv, "s:f:"))){
+		switch(opt){
+			case 's':
+				if((speed = atof(optarg)) <= 0){
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'f':
+				path = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if(argc - optind != 2){
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	host = argv[optind];
+	port = atoi(argv[optind + 1]);
+
+	if(sethandler(SIG_IGN,SIGPIPE)) ERR("Seting SIGPIPE:");
+	if(sethandler(sigint_handler,SIGINT)) ERR("Seting SIGINT:");
+
+	records = mapRecords(path, &games_len);
+	if(0 == games_len){
+		fprintf(stderr, "%s: no games\n", path);
+		return EXIT_FAILURE;
+	}
+	if(NULL == (games = calloc(games_len, sizeof(replay_struct)))) ERR("calloc");
+	if(NULL == (timers = malloc(games_len * sizeof(timer_struct)))) ERR("malloc");
+	for(i = 0; i < games_len; i++){
+		games[i].record = &records[i];
+		games[i].x = games[i].o = -1;
+	}
+	qsort(games, games_len, sizeof(replay_struct), gameCompare);
+	first_us = games[0].record->start_us;
+	for(i = 0; i < games_len; i++){
+		end = games[i].record->start_us - first_us;
+		if(games[i].record->moves_len > 0){
+			end += games[i].record->move_us[games[i].record->moves_len - 1];
+		}
+		if(end > span){
+			span = end;
+		}
+	}
+
+	if(-1 == (epollfd = epoll_create1(EPOLL_CLOEXEC))) ERR("epoll_create1");
+	start = nowUs();
+	replay();
+	done = games_done;
+
+	for(i = 0; i < games_len; i++){
+		matched += REPLAY_DONE == games[i].phase && gameMatches(&games[i]);
+		gameFinish(i);
+	}
+	printf("replayed %d of %d games in %.3f s, recorded %.3f s at speed %g\n",
+		done, games_len, (nowUs() - start) / 1e6, span / 1e6, speed);
+	printf("%d games ended as recorded\n", matched);
+	return EXIT_SUCCESS;
+}
@@ -9,24 +9,136 @@
 #include <sys/un.h>
 #include <sys/time.h>
 #include <sys/wait.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <signal.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <dirent.h>
-#include <sys/sem.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <sys/epoll.h>
+#include <stdint.h>
 #include <time.h>
+#include <sched.h>
+#include <math.h>
+#include <inttypes.h>
+#include <sys/random.h>
+#include <poll.h>
+#include "protocol.h"
+#include "record.h"
 
 #define ERR(source) (perror(source),\
 		     fprintf(stderr,"%s:%d\n",__FILE__,__LINE__),\
 		     exit(EXIT_FAILURE))
 
-#define LOGFILE "logs.txt"			 
-#define BACKLOG 3
+// trace points, built in only with -DTRACE, see traceInit
+#ifdef TRACE
+#define TRACE_BEGIN(name) traceEvent(name, 'B')
+#define TRACE_END(name) traceEvent(name, 'E')
+#define TRACE_FORK(name, id) traceFork(name, id)
+#else
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+#define TRACE_FORK(name, id) ((void)0)
+#endif
+
+#define BACKLOG 4096
+#define ACCEPT_BATCH 64
 #define MAX_LEN 256
-#define MAX_player_array 128
+#define MAX_player_array 65536
+#define INDEX_CHUNK 128
+#define MAX_EVENTS 256
+
+// chat all ring size and messages gathered per send
+#define CHAT_RING 256
+#define CHAT_BATCH 16
+#define CHAT_FRAME (MAX_LEN + PROTO_HEADER)
+
+// retry period for players whose socket was full, in nanoseconds
+#define CHAT_RETRY 50000000
+
+// default output queue watermarks in bytes, -o changes them
+#define OUT_HIGH (64 * 1024)
+#define OUT_LOW (16 * 1024)
+// smallest high watermark, one legacy turn (board and messages) must fit below it
+#define OUT_MIN (MAX_LEN * 16)
+
+// slow client policies used when output queue reaches high watermark
+#define SLOW_DROP 0
+#define SLOW_COALESCE 1
+#define SLOW_DISCONNECT 2
+
+// seconds forked player process waits for a client that does not read
+#define SEND_TIMEOUT 5
+
+// game record ring size, logger drain period in nanoseconds and seconds between fsyncs
+#define LOG_RING 1024
+#define LOG_PERIOD 100000000
+#define LOG_SYNC 1
+
+// rating table size, rating of new nickname and Elo factor
+#define RATING_TABLE 65536
+#define RATING_START 1500
+#define RATING_K 32
+
+// rated matchmaking: waiting queues are buckets of RATING_BUCKET points,
+// rating window starts at MATCH_WINDOW and grows MATCH_WIDEN points a second,
+// waiting players are rematched every MATCH_PERIOD milliseconds
+#define RATING_BUCKET 32
+#define WAIT_BUCKETS 128
+#define MATCH_WINDOW 100
+#define MATCH_WIDEN 50
+#define MATCH_PERIOD 250
+
+// kept games of dropped players are checked every RESUME_PERIOD milliseconds,
+// resume tokens are SESSION_LEN hex digits
+#define RESUME_PERIOD 1000
+#define SESSION_LEN 16
+
+// metrics histograms are exact below 2^HIST_SUB_BITS and split every power of two
+// into 2^HIST_SUB_BITS buckets above, values from 2^HIST_EXP up share last bucket
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_EXP 40
+#define HIST_BUCKETS ((HIST_EXP - HIST_SUB_BITS + 1) * HIST_SUB)
+
+// metrics counters
+#define METRIC_ACCEPTED 0
+#define METRIC_REFUSED 1
+#define METRIC_LEFT 2
+#define METRIC_GAMES_STARTED 3
+#define METRIC_GAMES_ENDED 4
+#define METRIC_MESSAGES 5
+#define METRIC_WRITTEN 6
+#define METRIC_SLOW 7
+#define METRIC_CONTENDED 8
+#define METRICS 9
+
+// metrics histograms, times in nanoseconds
+#define HIST_ACCEPT 0
+#define HIST_LOCK_WAIT 1
+#define HIST_LOCK_HOLD 2
+#define HIST_MOVE 3
+#define HIST_WRITE 4
+#define HIST_QUEUE 5
+#define HIST_EVENTS 6
+#define HISTS 7
+
+// nested mutexes whose hold time one process tracks
+#define LOCK_DEPTH 4
+
+// trace events kept by each process, file they are appended to on SIGUSR1
+// and size of formatted chunk written at once
+#define TRACE_RING 65536
+#define TRACE_FILE "trace.json"
+#define TRACE_CHUNK 65536
+
+// chat room name size and rooms one player can be in
+#define ROOM_NAME 32
+#define ROOMS_PER_PLAYER 8
 
 
 // player states
@@ -35,55 +147,176 @@
 #define PLAYING 2
 #define FINISHED 3
 
-// msg types
-#define CHATPRV 0
-#define MOVE 1
-#define CHATALL 2
+// reactor connection phases
+#define CONN_WAITING 0
+#define CONN_NICK 1
+#define CONN_PLAYING 2
 
 // game symbol
 #define EMPTYCELL '-'
 #define X 'X'
 #define O 'O'
 
+// game state word
+//	bits 0-24 X cells, 25-49 O cells, 50 O moves, 51 game over, 52-63 generation
+#define GAME_CELLS 25
+#define GAME_O_SHIFT 25
+#define GAME_TURN_BIT (1ULL << 50)
+#define GAME_OVER_BIT (1ULL << 51)
+#define GAME_GEN_SHIFT 52
+#define GAME_GEN_MASK 0xFFF
+#define GAME_X_CELLS(s) ((s) & 0x1FFFFFFULL)
+#define GAME_O_CELLS(s) (((s) >> GAME_O_SHIFT) & 0x1FFFFFFULL)
+#define GAME_GEN(s) ((int)((s) >> GAME_GEN_SHIFT))
+
+// winning line masks over 25 bit cell sets, shifted by row or column
+#define BOARD_FULL 0x1FFFFFFULL
+#define BOARD_ROW 0x1FULL
+#define BOARD_COL 0x108421ULL
+#define BOARD_DIAG 0x1041041ULL
+#define BOARD_ANTI 0x111110ULL
+
 volatile sig_atomic_t do_work=1;
-int semid;
 
 int pipes[2];
 
+// single process epoll mode
+int reactor_mode = 0;
+
+// rated matchmaking, players are named before they wait for opponent
+int match_mode = 0;
+
+// seconds game of dropped epoll player is kept for them to resume, 0 if disabled,
+// players are named before pairing too so resuming client is never paired
+int resume_grace = 0;
+int epollfd = -1;
+
+// chat all pipes of every reactor shard, pipes holds the one of this process
+int (*shard_pipes)[2] = NULL;
+int shard_count = 1;
+
+// shard of this process, 0 when not sharded
+int shard_id = 0;
+
+// MSG_STRUCT - player message decoded from either protocol
+typedef struct {
+
+	// MSG_MOVE, MSG_CHAT, MSG_CHATALL, MSG_ROOM, MSG_JOIN or MSG_LEAVE,
+	// nickname comes as any type
+	int type;
+
+	// cell for MSG_MOVE
+	int move;
+
+	// nul terminated text, legacy moves keep their frame here too,
+	// room commands keep room name and message without command prefix
+	char text[MAX_LEN];
+
+} msg_struct;
+
 int addPlayer(int);
 void removePlayer(int);
 int getBySocket(int);
 int getByPID(pid_t);
 int getUnpairedPlayer(int);
+void pairPlayers(int, int);
+int matchFind(int, int, int);
+void matchEnqueue(int);
+void matchStart(int, int);
+void matchTick();
+int ratingGet(char*);
+void ratingUpdate(char*, char*, int);
+int64_t monotonicUs();
+void reactorPlayerStart(int);
+void reactorPlayerAdd(int);
+void serverPlayerAdd(int, int);
+void mainClientProcess(int, int, int);
+void pidMapPut(pid_t, int);
+void sharedMemoryCommit(int);
 void sendBoard(int, char b[]);
+void sendBoardText(int, char b[]);
+void sendDelta(int, uint64_t, int, char);
+void sendFull(int);
 void clearBoard(char b[]);
 void sendText(int, char* str);
 void sendSplit(int);
-void lockSemaphore(int);
-void unlockSemaphore(int);
-int boardState(char, char*);
+void sendMsg(int, int, char*, int);
+int socketProto(int);
+void playerHello(int, char*, int);
+void msgLegacy(char*, msg_struct*);
+int msgBinary(int, char*, int, msg_struct*);
+void lockPlayer(int);
+void unlockPlayer(int);
+void lockGame(int);
+void unlockGame(int);
+void lockPair(int, int);
+void unlockPair(int, int);
+void lockMutex(int*);
+int lockMutexTimed(int*, int);
+int tryLockMutex(int*);
+void unlockMutex(int*);
+int boardState(char, uint64_t, int);
+char playerSymbol(int);
+void gameBoard(uint64_t, char*);
+void gameStart(int, int, int);
+void gameRecord(record_struct*, int, int, uint64_t, int);
+int64_t nowUs();
+uint64_t gameAbandon(int);
+int isPlayerTurn(int);
 void chatPrv(int,char*);
-int playerCommunicationInit(int,FILE*);
+int playerCommunicationInit(int);
 int playerInit(int);
-void broadcastListen( int );
-
-// http://linux.die.net/man/2/semctl
-union semun {		
-
-	// Value for SETVAL
-	int              val;
-	
-	// Buffer for IPC_STAT, IPC_SET
-	struct semid_ds *buf;    /*  */
-	
-	// Array for GETALL, SETALL
-	unsigned short  *array;  /*  */
-	
-	// Buffer for IPC_INFO
-	struct seminfo  *__buf;  
-};
+void playerNickname(int, char*);
+void playerName(int, char*);
+void playerMessage(int, msg_struct*);
+int broadcastListen( int );
+int broadcastFrame();
+int chatDeliver(int);
+int chatSend(int);
+int chatTailSend(int, int);
+int chatTailClose(int, int);
+void chatPublish(int, char*, int, char*);
+void logGame(record_struct*);
+void logWake();
+void loggerProcess(pid_t);
+int recordOpen();
+void chatMark(int);
+void chatMarkRoom(int);
+int roomFind(char*, int);
+int roomMember(int, char*);
+void roomJoin(int, char*);
+void roomLeave(int, int);
+void roomLeaveAll(int);
+void growIndex(int**, int*, int);
+void chatSubscribe(int);
+ssize_t sendFrame(int, char*, size_t);
+ssize_t batchQueue(int, char*, size_t);
+int socketGone(int);
+int connAdmit(int, int);
+int connQueue(int, char*, size_t);
+int listenInit(char*, int);
+int namedFirst();
+void playerLeave(int);
+int sessionKept(int, int);
+void sessionIssue(int);
+int sessionResume(int, char*);
+void slotFree(int);
+void socketMapPut(int, int);
+int sessionDetach(int);
+void sessionTick();
+#ifdef TRACE
+void traceEvent(const char*, char);
+void traceFork(const char*, int);
+#endif
+int64_t metricsNow();
+void metricsCount(int, uint64_t);
+void metricsObserve(int, uint64_t);
+void metricsLocked(int*, int64_t);
+void metricsUnlocked(int*);
+ssize_t socket_write(int, char*, size_t);
 
 // PLAYER_STRUCT
+// hot part, read on every move, two slots share cache line
 typedef struct {	
 
 	//	0 - IDLE
@@ -101,19 +334,387 @@ typedef struct {
 	// id of paried player
 	int pairnum;
 	
-	// player nick name
-	char name[64];
-	
-	// game board
-	char board[25];
-	
-	// if player is moving now
-	int movieing;
+	// game_array pos
+	int game;
+
+	// generation of the game record when it was paired, PROTO_LEGACY or PROTO_BINARY
+	short gamegen, proto;
+
+	// futex word guarding this slot
+	int lock;
 	
-} player_struct;
+} __attribute__((aligned(32))) player_struct;
 
 player_struct* player_array;
 
+// PLAYER_INFO_STRUCT - cold part of player slot, same index as player_array
+typedef struct {
+
+	// player nick name
+	char name[64];
+
+	// resume token, 0 until it is issued
+	uint64_t session;
+
+	// futex word held while forked processes write to player socket, broadcaster
+	// keeps it while chat frame is only partly sent so no frame lands inside
+	int write_lock;
+
+} player_info_struct;
+
+player_info_struct* player_info;
+
+// private indexes of the process accepting players, see indexInit
+int* free_slots = NULL;
+int free_len = 0, slot_next = 0, slot_size = 0;
+int* socket_slots = NULL;
+int socket_slots_size = 0;
+pid_t* pid_map_keys = NULL;
+int* pid_map_values = NULL;
+int pid_map_size = 0, pid_map_len = 0;
+int* wait_next = NULL;
+int* wait_prev = NULL;
+int* wait_bucket = NULL;
+int64_t* wait_since = NULL;
+int wait_head[WAIT_BUCKETS], wait_tail[WAIT_BUCKETS];
+int wait_len = 0;
+int64_t* detach_since = NULL;
+int* detached = NULL;
+int detached_len = 0, detached_size = 0;
+
+// GAME_STRUCT - game record shared by both players, changed only by compare and swap
+// one record per cache line so moves in different games do not bounce lines
+typedef struct {
+
+	// see game state word
+	uint64_t state;
+
+	// cells in order of moves, move n is written before state with n taken cells
+	// is replaced, so anyone who reads state sees moves that led to it
+	unsigned char moves[GAME_CELLS];
+
+} __attribute__((aligned(64))) game_struct;
+
+game_struct* game_array;
+
+// GAME_CLOCK_STRUCT - move times of game with same index, kept apart from game
+// records because only game log reads them
+typedef struct {
+
+	// pairing time as unix time for game log and as monotonic time for durations
+	int64_t start_us, start_mono;
+
+	// time of each move since pairing, written same way as moves
+	uint32_t move_us[GAME_CELLS];
+
+} game_clock_struct;
+
+game_clock_struct* game_clocks;
+
+// CHAT_ENTRY_STRUCT - chat message or room membership change
+typedef struct {
+
+	// room of MSG_ROOM, MSG_JOIN and MSG_LEAVE
+	char room[ROOM_NAME];
+
+	// player joining or leaving, slots are private to shard
+	int slot, shard;
+
+	// binary header followed by zero padded legacy frame, type is MSG_CHATALL,
+	// MSG_ROOM, MSG_JOIN or MSG_LEAVE
+	char frame[PROTO_HEADER + MAX_LEN];
+
+} chat_entry_struct;
+
+// CHAT_STRUCT - ring of last chat entries shared by every process
+// broadcasters keep private cursor of each player, slow players lose oldest messages
+typedef struct {
+
+	// futex word guarding append
+	int lock;
+
+	// number of entries ever published
+	uint64_t head;
+
+	// entry n is entries[n % CHAT_RING]
+	chat_entry_struct entries[CHAT_RING];
+
+} chat_struct;
+
+chat_struct* chat;
+
+// RATING_ENTRY_STRUCT - Elo rating of one nickname
+typedef struct {
+
+	// nul terminated nickname, empty for free entry
+	char name[64];
+
+	int rating, games;
+
+} rating_entry_struct;
+
+// RATING_STRUCT - ratings of every nickname seen since server start,
+// open addressing table shared by every process
+typedef struct {
+
+	// futex word guarding table
+	int lock;
+
+	// used entries, table stops taking new names when it is full
+	int len;
+
+	rating_entry_struct entries[RATING_TABLE];
+
+} rating_struct;
+
+rating_struct* ratings;
+
+// LOG_ENTRY_STRUCT - game record waiting for logger
+typedef struct {
+
+	// queue position when entry is free, position + 1 when it is filled
+	uint64_t seq;
+
+	record_struct record;
+
+} __attribute__((aligned(64))) log_entry_struct;
+
+// LOG_STRUCT - bounded queue of game records shared by every process
+// players append without locks, single logger process appends them to record file
+typedef struct {
+
+	// next position to fill, taken by compare and swap
+	uint64_t head;
+
+	// futex word logger sleeps on, changed to wake it early
+	int doorbell;
+
+	// set when server stops, logger writes what is left and exits
+	int stop;
+
+	// next position logger drains, read by stats process
+	uint64_t tail;
+
+	// entry n is entries[n % LOG_RING]
+	log_entry_struct entries[LOG_RING];
+
+} log_struct;
+
+log_struct* game_log;
+pid_t logger_pid;
+
+// HIST_STRUCT - HDR style histogram, see HIST_SUB_BITS
+typedef struct {
+
+	// sum of observed values and number of them in each bucket
+	uint64_t sum;
+	uint64_t buckets[HIST_BUCKETS];
+
+} hist_struct;
+
+// METRICS_STRUCT - counters and histograms of one worker, every shard has its own,
+// forked players share one of their server, all of them only add atomically
+typedef struct {
+
+	uint64_t counters[METRICS];
+	hist_struct hists[HISTS];
+
+} __attribute__((aligned(64))) metrics_struct;
+
+// METRIC_INFO_STRUCT - exposition name and help of counter or histogram
+typedef struct {
+
+	char* name;
+	char* help;
+
+	// histogram buckets are exported up to powers of two from 2^low to 2^high,
+	// scale turns value to exported unit
+	int low, high;
+	double scale;
+
+} metric_info_struct;
+
+metric_info_struct metric_info[METRICS] = {
+	{"connections_accepted_total", "Connections accepted."},
+	{"connections_refused_total", "Connections refused because player table or descriptors ran out."},
+	{"players_left_total", "Players removed from player table."},
+	{"games_started_total", "Games started."},
+	{"games_ended_total", "Games finished, tied or abandoned and queued for logger."},
+	{"messages_total", "Player messages handled."},
+	{"written_bytes_total", "Bytes written to player sockets."},
+	{"slow_clients_total", "Players disconnected for not reading their output."},
+	{"lock_contended_total", "Mutex acquisitions that had to wait."},
+};
+
+metric_info_struct hist_info[HISTS] = {
+	{"accept_seconds", "Time from listener readiness until accepted player is set up.", 8, 30, 1e-9},
+	{"lock_wait_seconds", "Time waited for player, chat and rating mutexes.", 6, 30, 1e-9},
+	{"lock_hold_seconds", "Time player, chat and rating mutexes were held.", 6, 30, 1e-9},
+	{"move_seconds", "Time to apply move and queue or send its updates.", 8, 30, 1e-9},
+	{"write_seconds", "Duration of writes to player sockets.", 8, 33, 1e-9},
+	{"output_queue_bytes", "Output pending for player socket when it is written.", 4, 20, 1},
+	{"epoll_events", "Events returned by one epoll wait.", 0, 8, 1},
+};
+
+// metrics of every worker and the one of this process, NULL when metrics are off
+metrics_struct* metrics_array = NULL;
+metrics_struct* metrics = NULL;
+int metrics_len = 0;
+
+// unix socket path metrics are served on, -s sets it, and process serving them
+char* stats_path = NULL;
+pid_t stats_pid;
+
+// mutexes held by this process and when they were taken
+int* lock_held[LOCK_DEPTH];
+int64_t lock_taken[LOCK_DEPTH];
+int lock_held_len = 0;
+
+#ifdef TRACE
+// TRACE_EVENT_STRUCT - start or end of traced stage
+typedef struct {
+
+	// monotonic time in nanoseconds
+	int64_t ts;
+
+	// stage name, string literal so it stays valid in forked processes
+	const char* name;
+
+	// 'B' begin or 'E' end
+	char phase;
+
+} trace_event_struct;
+
+// private ring of this process, event n is trace_ring[n % TRACE_RING],
+// only traced code changes trace_len and only dump changes trace_dumped
+trace_event_struct trace_ring[TRACE_RING];
+uint64_t trace_len = 0, trace_dumped = 0;
+
+// process name shown in trace viewer and process that forwards dumps to logger
+char trace_name[32] = "server";
+pid_t trace_main = 0;
+char trace_chunk[TRACE_CHUNK];
+#endif
+
+// broadcaster state: next chat entry of each player slot and of broadcaster itself,
+// players waiting for delivery, rooms of each slot and unsent end of frame that
+// forked player socket took only part of
+uint64_t* chat_cursor = NULL;
+char* chat_tail = NULL;
+int* chat_tail_len = NULL;
+uint64_t chat_seen = 0;
+int* chat_pending = NULL;
+int chat_pending_len = 0, chat_pending_size = 0;
+int* chat_marked = NULL;
+int* slot_rooms = NULL;
+
+// ROOM_STRUCT - chat room known to broadcaster, rooms with same name in other
+// shards share messages through chat ring
+typedef struct {
+
+	// room name
+	char name[ROOM_NAME];
+
+	// member slots
+	int* members;
+	int len, size;
+
+} room_struct;
+
+room_struct* rooms = NULL;
+int rooms_len = 0, rooms_size = 0;
+
+// room name hash map to rooms pos
+int* room_map = NULL;
+int room_map_size = 0;
+
+// ARENA_STRUCT - shared array reserved for whole capacity and backed on demand
+typedef struct {
+
+	// mapping and backing memfd
+	char* base;
+	int fd;
+
+	// element size, reserved and backed element counts
+	size_t elem, capacity, committed;
+
+} arena_struct;
+
+arena_struct game_arena, clock_arena, player_arena, info_arena, chat_arena, log_arena, rating_arena, metrics_arena;
+
+// player table size limit, -c changes it
+int player_capacity = MAX_player_array;
+
+// output queue watermarks and slow client policy, -o and -p change them
+size_t out_high = OUT_HIGH, out_low = OUT_LOW;
+int slow_policy = SLOW_COALESCE;
+
+// listen backlog, -b changes it, and descriptor kept free to refuse connections when out of them
+int listen_backlog = BACKLOG;
+int spare_fd = -1;
+
+// unix socket path players may connect to besides TCP port, -u sets it,
+// and its listener shared by shards
+char* unix_path = NULL;
+int unix_fd = -1;
+
+// CONN_STRUCT - reactor side state of a player socket
+typedef struct {
+
+	// player_array pos or -1 if not added yet
+	int playerId;
+
+	//	0 - CONN_WAITING
+	//	1 - CONN_NICK
+	//	2 - CONN_PLAYING
+	int phase;
+
+	// set when connection waits for close, set when output waits for flush
+	int closing, queued;
+
+	// set when board update was dropped under backpressure
+	int stale;
+
+	// partially read frame of either protocol
+	char in[MAX_LEN + PROTO_HEADER];
+	size_t inlen;
+
+	// pending output
+	char* out;
+	size_t outlen, outoff, outcap;
+
+} conn_struct;
+
+// connections indexed by socket
+conn_struct** conns = NULL;
+int conns_size = 0;
+
+// sockets waiting for close at the end of reactor iteration
+int* closing = NULL;
+int closing_len = 0, closing_size = 0;
+
+// sockets with output gathered during reactor iteration
+int* flushing = NULL;
+int flushing_len = 0, flushing_size = 0;
+
+// BATCH_STRUCT - output gathered by forked player process while it handles one message
+typedef struct {
+
+	// destination socket
+	int socket;
+
+	// frames in order they were sent
+	char* buf;
+	size_t len, cap;
+
+} batch_struct;
+
+// player process writes only to itself and its opponent
+#define BATCH_SOCKETS 4
+
+batch_struct batch[BATCH_SOCKETS];
+int batch_len = 0, batch_active = 0;
+
 // safe closing a file descriptor  of a socket
 int safe_close(int fd){
 	int status;
@@ -161,12 +762,10 @@ void sigchld_handler(int sig){
 				
 			// child pid returned
 			} else {
-				lockSemaphore(0);
 				int p = getByPID(pid);
 				if (p > -1){
 					removePlayer(p);
 				}
-				unlockSemaphore(0);
 			}
 		}
 	}
@@ -193,8 +792,8 @@ int make_socket(int domain, int type){
 	return sock;
 }
 
-// create socket handler
-int bind_inet_socket(uint16_t port,int type){
+// create socket handler, reuseport lets every shard bind its own listener
+int bind_inet_socket(uint16_t port,int type,int reuseport){
 	struct sockaddr_in addr;
 	int socketfd;
 	int t = 1;
@@ -210,29 +809,113 @@ int bind_inet_socket(uint16_t port,int type){
 	
 	// use socket on socket level, reuse if not listening
 	if(setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR,&t, sizeof(t))) ERR("setsockopt");
+	if(reuseport && setsockopt(socketfd, SOL_SOCKET, SO_REUSEPORT,&t, sizeof(t))) ERR("setsockopt");
 	if(bind(socketfd,(struct sockaddr*) &addr,sizeof(addr)) < 0)  ERR("bind");
 	if(SOCK_STREAM == type){
-		if(listen(socketfd, BACKLOG) < 0) ERR("listen");
+		if(listen(socketfd, listen_backlog) < 0) ERR("listen");
+	}
+	return socketfd;
+}
+
+// create unix socket handler, socket left on path by server that did not stop
+// cleanly is replaced, any other file there is an error, caller unlinks path when done
+int bind_unix_socket(char* path, int type){
+	struct sockaddr_un addr;
+	struct stat st;
+	int socketfd;
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	if(strlen(path) >= sizeof(addr.sun_path)){
+		fprintf(stderr, "socket path too long: %s\n", path);
+		exit(EXIT_FAILURE);
 	}
+	strcpy(addr.sun_path, path);
+	if(0 == lstat(path, &st)){
+		if(!S_ISSOCK(st.st_mode)){
+			fprintf(stderr, "not a socket, refusing to replace: %s\n", path);
+			exit(EXIT_FAILURE);
+		}
+		if(unlink(path) < 0 && ENOENT != errno) ERR("unlink");
+	} else if(ENOENT != errno) ERR("lstat");
+	socketfd = make_socket(PF_UNIX, type);
+	if(bind(socketfd, (struct sockaddr*) &addr, sizeof(addr)) < 0) ERR("bind");
+	if(listen(socketfd, listen_backlog) < 0) ERR("listen");
 	return socketfd;
 }
 
-// accept new connections
-int add_new_client(int sfd){
-	int nfd;
-	if((nfd = TEMP_FAILURE_RETRY(accept(sfd,NULL,NULL))) < 0) {
-		if(EAGAIN == errno
-			|| EWOULDBLOCK == errno){
-			return -1;
+// accepts up to max pending connections with given accept4 flags, returns their number
+// connections lost before accept are skipped, without free descriptors pending
+// ones are closed using spare descriptor so clients do not wait in backlog
+int add_new_clients(int sfd, int* sockets, int max, int flags){
+	int n = 0, nfd;
+	while(n < max){
+		if((nfd = TEMP_FAILURE_RETRY(accept4(sfd, NULL, NULL, flags))) >= 0){
+			sockets[n++] = nfd;
+			continue;
+		}
+		if(EAGAIN == errno || EWOULDBLOCK == errno){
+			break;
+		}
+		if(ECONNABORTED == errno || EPROTO == errno || EPERM == errno){
+			continue;
+		}
+		if((EMFILE == errno || ENFILE == errno) && -1 != spare_fd && 0 == n){
+			// accept fails with EMFILE even on empty queue, so stop once nothing is shed
+			if(safe_close(spare_fd) < 0) ERR("close");
+			if((nfd = TEMP_FAILURE_RETRY(accept(sfd, NULL, NULL))) >= 0 && safe_close(nfd) < 0) ERR("close");
+			spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+			if(nfd < 0){
+				break;
+			}
+			fprintf(stderr, "out of descriptors, connection refused\n");
+			metricsCount(METRIC_REFUSED, 1);
+			continue;
 		}
-		ERR("accept");
+		if(EMFILE == errno || ENFILE == errno || ENOBUFS == errno || ENOMEM == errno){
+			break;
+		}
+		ERR("accept4");
 	}
-	return nfd;
+	return n;
+}
+
+// bounds kernel output queue of blocking player socket and time spent waiting on it
+void send_limit(int socket){
+	struct timeval timeout = {SEND_TIMEOUT, 0};
+	int size = out_high;
+	if(setsockopt(socket, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size))) ERR("setsockopt");
+	if(setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))) ERR("setsockopt");
+}
+
+// coalesced writes already batch frames, Nagle would only hold the last one
+// back until the client acknowledges the previous move
+void no_delay(int socket){
+	int t = 1;
+	if(setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &t, sizeof(t))) ERR("setsockopt");
+}
+
+// parses slow client policy name, returns -1 if it is unknown
+int slowPolicy(char* name){
+	if(0 == strcmp(name, "drop")) return SLOW_DROP;
+	if(0 == strcmp(name, "coalesce")) return SLOW_COALESCE;
+	if(0 == strcmp(name, "disconnect")) return SLOW_DISCONNECT;
+	return -1;
 }
 
 // manual
 void usage(char* name){
-	fprintf(stderr,"USAGE: %s [PORT]\n",name);
+	fprintf(stderr,"USAGE: %s [-e] [-w N] [-m] [-c CAPACITY] [-o HIGH[:LOW]] [-p POLICY] [-b BACKLOG] [-r GRACE] [-s PATH] [-u PATH] [PORT]\n",name);
+	fprintf(stderr,"\t-e\tserve all players from single epoll process\n");
+	fprintf(stderr,"\t-w N\tstart N epoll shards sharing the port with SO_REUSEPORT\n");
+	fprintf(stderr,"\t-m\tpair epoll players by rating, needs -e or -w\n");
+	fprintf(stderr,"\t-c CAPACITY\tplayer table limit per process, default %d\n",MAX_player_array);
+	fprintf(stderr,"\t-o HIGH[:LOW]\toutput queue watermarks in bytes, default %d:%d\n",OUT_HIGH,OUT_LOW);
+	fprintf(stderr,"\t-p POLICY\tepoll slow client policy at high watermark: drop (chat), coalesce (chat and boards, default) or disconnect\n");
+	fprintf(stderr,"\t\tforked players disconnect clients that do not read for %d s\n",SEND_TIMEOUT);
+	fprintf(stderr,"\t-r GRACE\tkeep game of dropped epoll player for GRACE seconds so they can resume it, needs -e or -w\n");
+	fprintf(stderr,"\t-b BACKLOG\tlisten backlog, default %d, kernel caps it at somaxconn\n",BACKLOG);
+	fprintf(stderr,"\t-s PATH\tserve prometheus text metrics on unix socket PATH\n");
+	fprintf(stderr,"\t-u PATH\taccept players on unix socket PATH too, local clients skip TCP\n");
 }
 
 // read block
@@ -268,86 +951,160 @@ ssize_t bulk_write(int fd, char *buf, size_t count){
 	return len ;
 }
 
+// write frame to player socket, in reactor mode it is queued on its connection
+// forked player process gathers frames between batchBegin and batchEnd
+ssize_t sendFrame(int socket, char *buf, size_t count){
+	if(reactor_mode){
+		return connQueue(socket, buf, count);
+	}
+	if(batch_active){
+		return batchQueue(socket, buf, count);
+	}
+	return socket_write(socket, buf, count);
+}
+
+// blocking write to player socket, timed for metrics
+ssize_t socket_write(int socket, char *buf, size_t count){
+	int64_t start = metricsNow();
+	int num = getBySocket(socket);
+	ssize_t size;
+	TRACE_BEGIN("write");
+
+	// broadcaster holding unsent chat tail counts as output client did not read
+	if(num >= 0 && !lockMutexTimed(&player_info[num].write_lock, SEND_TIMEOUT)){
+		TRACE_END("write");
+		errno = EAGAIN;
+		return -1;
+	}
+	size = bulk_write(socket, buf, count);
+	if(num >= 0){
+		unlockMutex(&player_info[num].write_lock);
+	}
+	TRACE_END("write");
+	if(size > 0){
+		metricsObserve(HIST_WRITE, metricsNow() - start);
+		metricsCount(METRIC_WRITTEN, size);
+	}
+	return size;
+}
+
+// starts gathering frames of forked player process
+void batchBegin(){
+	batch_active = 1;
+}
+
+// appends frame to output of given socket
+ssize_t batchQueue(int socket, char *buf, size_t count){
+	batch_struct* b;
+	int i;
+	for(i = 0; i < batch_len && batch[i].socket != socket; i++);
+	if(i == BATCH_SOCKETS){
+		if(socket_write(batch[0].socket, batch[0].buf, batch[0].len) < 0) return -1;
+		batch[0].len = 0;
+		batch[0].socket = socket;
+		i = 0;
+	} else if(i == batch_len){
+		batch[batch_len].socket = socket;
+		batch[batch_len++].len = 0;
+	}
+	b = &batch[i];
+	if(b->len + count > b->cap){
+		b->cap = b->cap ? b->cap : MAX_LEN * 8;
+		while(b->len + count > b->cap){
+			b->cap *= 2;
+		}
+		if(NULL == (b->buf = realloc(b->buf, b->cap))) ERR("realloc");
+	}
+	memcpy(b->buf + b->len, buf, count);
+	b->len += count;
+	return count;
+}
+
+// sends gathered frames, one write per socket
+void batchEnd(){
+	int i;
+	batch_active = 0;
+	for(i = 0; i < batch_len; i++){
+		metricsObserve(HIST_QUEUE, batch[i].len);
+		if(socket_write(batch[i].socket, batch[i].buf, batch[i].len) < 0 && !socketGone(batch[i].socket)) ERR("batch write");
+	}
+	batch_len = 0;
+}
+
 // 00 01 02 03 04
 // 05 06 07 08 09
 // 10 11 12 13 14
 // 15 16 17 18 19
 // 20 21 22 23 24
-// check if given symbol has won returns 1 if winner exists or 0 if not
-int isWinner(char player_arrayymbol, char* board){
+// cells of one symbol as bitboard, bit n is cell n
+// check if given cells contain a line returns 1 if winner exists or 0 if not
+int isWinner(uint64_t cells){
 	int i;
 	
-	// left top to bottom right
-	if(board[0]==player_arrayymbol 
-		&& board[6]==player_arrayymbol
-		&& board[12]==player_arrayymbol
-		&& board[18]==player_arrayymbol
-		&& board[24]==player_arrayymbol){
-		return 1;
-	}
-	
-	// right top to bottom left
-	if(board[4]==player_arrayymbol
-		&& board[8]==player_arrayymbol
-		&& board[12]==player_arrayymbol
-		&& board[16]==player_arrayymbol
-		&& board[20]==player_arrayymbol){
+	// both diagonals
+	if((cells & BOARD_DIAG) == BOARD_DIAG || (cells & BOARD_ANTI) == BOARD_ANTI){
 		return 1;
 	}
 	
+	// horizontal and vertical rules
 	for(i=0; i<5; i++){
-	
-		// horizontal rules
-		if(board[i*5]==player_arrayymbol
-			&& board[i*5+1]==player_arrayymbol
-			&& board[i*5+2]==player_arrayymbol
-			&& board[i*5+3]==player_arrayymbol
-			&& board[i*5+4]==player_arrayymbol){
-			return 1;
-		}
-		
-		// vertical rules
-		if(board[i]==player_arrayymbol
-			&& board[i+5]==player_arrayymbol
-			&& board[i+5*2]==player_arrayymbol
-			&& board[i+5*3]==player_arrayymbol
-			&& board[i+5*4]==player_arrayymbol){
+		if((cells & (BOARD_ROW << (i*5))) == (BOARD_ROW << (i*5))
+			|| (cells & (BOARD_COL << i)) == (BOARD_COL << i)){
 			return 1;
 		}
 	}
 	return 0;	
 }
 
-// if no emptycells return tie (1) or not (0)
-int isTie(char* board){
-	int i;
-	for(i=0; i<24; i++){
-		if(EMPTYCELL == board[i]){
-			return 0;
-		}
+// checks only lines going through cell just taken, cells must contain it
+int isWinningMove(uint64_t cells, int move){
+	uint64_t row = BOARD_ROW << (move - move % 5);
+	uint64_t col = BOARD_COL << (move % 5);
+	if((cells & row) == row || (cells & col) == col){
+		return 1;
 	}
-	return 1;
+	if(0 == move % 6 && (cells & BOARD_DIAG) == BOARD_DIAG){
+		return 1;
+	}
+	if(0 == move % 4 && move && move != 24 && (cells & BOARD_ANTI) == BOARD_ANTI){
+		return 1;
+	}
+	return 0;
+}
+
+// if no emptycells return tie (1) or not (0)
+int isTie(uint64_t state){
+	return BOARD_FULL == (GAME_X_CELLS(state) | GAME_O_CELLS(state));
 }
 
 //zwracam 0 jesli gra sie toczy; 1 jesli c wygral; 2 jesli remis
-int boardState(char player_arrayymbol, char* board ){
-	if(isWinner(player_arrayymbol, board)){
+int boardState(char symbol, uint64_t state, int move){
+	if(isWinningMove(X == symbol ? GAME_X_CELLS(state) : GAME_O_CELLS(state), move)){
 		return 1;
 	}
-	else if(isTie(board)){
+	else if(isTie(state)){
 		return 2;
 	}
 	return 0;
 }
 
-// check if game should be finished
-void checkGameStatus(int num, char* board,FILE* logfile){
+// check if game should be finished, state is the one left by players move
+void checkGameStatus(int num, uint64_t state){
 	char data[MAX_LEN];
-	lockSemaphore(0);
+	record_struct record;
+	int winner;
 	
 	// get player_array sockets
 	int pairsocket = player_array[num].pairsocket;
 	int socket = player_array[num].socket;
+
+	// if no one won and there is no tie the game continues
+	if (!(state & GAME_OVER_BIT)){
+		sendText( socket, "Waiting for opponent to move" );
+		// dont log data
+		return;
+	}
+	lockGame(num);
 	
 	// get time
 	time_t tt;
@@ -355,195 +1112,400 @@ void checkGameStatus(int num, char* board,FILE* logfile){
 	time(&tt);
 	t = localtime(&tt);	
 	
-	// we dont know if current player plays with X or O so we check for both
-	if (1 == boardState( X, board ) 
-		|| 1 == boardState( O, board )){
+	// only the player who just moved can be the winner
+	winner = isWinner(X == playerSymbol(num) ? GAME_X_CELLS(state) : GAME_O_CELLS(state));
+	if (winner){
 		// current player won
-		sprintf( data, "#%s gracz:  %s wygral z graczem:  %s\n", asctime(t), player_array[num].name, player_array[player_array[num].pairnum].name);		
+		sprintf( data, "#%s gracz:  %s wygral z graczem:  %s\n", asctime(t), player_info[num].name, player_info[player_array[num].pairnum].name);		
 	
-	// if neighter player won
+	// tie
 	} else {
-		// check for tie
-		if (2 == boardState( X, board )){
-			// tie
-			sprintf( data, "#%s gracz:  %s remisuje z graczem: %s\n", asctime(t), player_array[num].name, player_array[player_array[num].pairnum].name);	
-			
-		// if no tie the game continues
-		} else {
-			unlockSemaphore(0);			
-			sendText( socket, "Waiting for opponent to move" );
-			// dont log data
-			return;
-		}
+		sprintf( data, "#%s gracz:  %s remisuje z graczem: %s\n", asctime(t), player_info[num].name, player_info[player_array[num].pairnum].name);	
 	}		
 	
 	fprintf(stderr,"%s",data);
+	if(X == playerSymbol(num)){
+		gameRecord(&record, num, player_array[num].pairnum, state, winner ? RESULT_X : RESULT_TIE);
+	} else {
+		gameRecord(&record, player_array[num].pairnum, num, state, winner ? RESULT_O : RESULT_TIE);
+	}
 	// update player state
 	player_array[num].state = player_array[player_array[num].pairnum].state = FINISHED;
-	unlockSemaphore(0);
+	unlockGame(num);
+
+	// only matchmaking reads ratings, their lock is never taken under game lock
+	if(match_mode){
+		ratingUpdate(record.x_name, record.o_name, record.result);
+	}
 	
 	// send information
-	sendText(socket, data );	
-	sendText(pairsocket, data );	
+	sendMsg(socket, MSG_RESULT, data, strlen(data));
+	sendMsg(pairsocket, MSG_RESULT, data, strlen(data));
 	
 	// disconnect
 	sendSplit(socket);
 	sendSplit(pairsocket);	
 	
 	// log data
-	lockSemaphore(1);
-	fputs(data, logfile);
-	fputs(board,logfile);
-	fputs("\n",logfile);
-	unlockSemaphore(1);		
+	logGame(&record);
+}
+
+// player plays X if they started the game
+char playerSymbol(int num){
+	return PLAYING == player_array[num].state ? X : O;
+}
+
+// symbol of player who moves now
+char gameTurn(uint64_t state){
+	return (state & GAME_TURN_BIT) ? O : X;
 }
 
-// make a move
-void playerMove(int playerId, int move, FILE* fLog){
-	lockSemaphore(0);	
+// checks without any lock if player may move now
+int isPlayerTurn(int num){
+	uint64_t state = __atomic_load_n(&game_array[player_array[num].game].state, __ATOMIC_ACQUIRE);
+	return GAME_GEN(state) == player_array[num].gamegen
+		&& !(state & GAME_OVER_BIT)
+		&& gameTurn(state) == playerSymbol(num);
+}
+
+// make a move, cell claim, turn handoff and game end are one compare and swap
+void playerMove(int playerId, int move){
+	uint64_t old, new, cell;
+	uint32_t elapsed;
+	int taken;
+
+	// game fields are set while pairing and never change during the game
+	game_struct* game = &game_array[player_array[playerId].game];
+	game_clock_struct* timing = &game_clocks[player_array[playerId].game];
+	int gen = player_array[playerId].gamegen;
 	int pairsocket = player_array[playerId].pairsocket;
-	char* board = player_array[playerId].board;	
-	char* board2 = player_array[player_array[playerId].pairnum].board;
+	char symbol = playerSymbol(playerId);
 
-	if (player_array[playerId].state == PLAYING)	{
-		
-		// if X is moving
-		if (X != player_array[playerId].board[move] 
-			&& O != player_array[playerId].board[move]){
-			
-			// set symbol
-			player_array[playerId].board[move] = X;			
-			unlockSemaphore(0);
-			
-			sendBoard(pairsocket, board );
-			
-			// next player move
-			lockSemaphore(0);
-			player_array[playerId].movieing = 0;
-			player_array[player_array[playerId].pairnum].movieing = 1;
-			unlockSemaphore(0);
-			
-			checkGameStatus(playerId, board, fLog);
-		} else {
-			unlockSemaphore(0);
+	if(move < 0 || move >= GAME_CELLS){
+		return;
+	}
+	cell = 1ULL << move;
+	elapsed = monotonicUs() - timing->start_mono;
+	old = __atomic_load_n(&game->state, __ATOMIC_ACQUIRE);
+	do {
+		// stale or finished game, opponent turn or taken cell
+		if(GAME_GEN(old) != gen
+			|| (old & GAME_OVER_BIT)
+			|| gameTurn(old) != symbol
+			|| ((GAME_X_CELLS(old) | GAME_O_CELLS(old)) & cell)){
+			return;
 		}
-	} else {
-	
-		// if O is moving
-		if (X != player_array[player_array[playerId].pairnum].board[move] 
-			&& O != player_array[player_array[playerId].pairnum].board[move])	{
-			
-			// set symbol
-			player_array[player_array[playerId].pairnum].board[move] = O;
-			unlockSemaphore(0);
-			
-			sendBoard( pairsocket, board2 );
-			
-			// next player mpve
-			lockSemaphore(0);
-			player_array[playerId].movieing = 0;
-			player_array[player_array[playerId].pairnum ].movieing = 1;
-			unlockSemaphore(0);
-			
-			checkGameStatus(playerId, board2, fLog);
-		} else {
-			unlockSemaphore(0);
+		new = (old | (X == symbol ? cell : cell << GAME_O_SHIFT)) ^ GAME_TURN_BIT;
+		if(boardState(symbol, new, move)){
+			new |= GAME_OVER_BIT;
 		}
-	}	
+
+		// only player on turn gets here, failed exchange writes it again
+		taken = __builtin_popcountll(GAME_X_CELLS(old) | GAME_O_CELLS(old));
+		game->moves[taken] = move;
+		timing->move_us[taken] = elapsed;
+	} while(!__atomic_compare_exchange_n(&game->state, &old, new, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	sendDelta(pairsocket, new, move, symbol);
+
+	// binary player keeps its own board, legacy one gets it with opponent move
+	if(PROTO_BINARY == socketProto(player_array[playerId].socket)){
+		sendDelta(player_array[playerId].socket, new, move, symbol);
+	}
+	TRACE_BEGIN("checkGameStatus");
+	checkGameStatus(playerId, new);
+	TRACE_END("checkGameStatus");
 }
 
-// private chat with opponent
+// ends game of given player if it is still running, returns final state
+uint64_t gameAbandon(int num){
+	game_struct* game = &game_array[player_array[num].game];
+	uint64_t old = __atomic_load_n(&game->state, __ATOMIC_ACQUIRE);
+	while(GAME_GEN(old) == player_array[num].gamegen
+		&& !(old & GAME_OVER_BIT)
+		&& !__atomic_compare_exchange_n(&game->state, &old, old | GAME_OVER_BIT, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	return old;
+}
+
+// fills binary record of finished game, state is final game state
+void gameRecord(record_struct* r, int x, int o, uint64_t state, int result){
+	game_struct* game = &game_array[player_array[x].game];
+	game_clock_struct* timing = &game_clocks[player_array[x].game];
+	memset(r, 0, sizeof(record_struct));
+	r->time = time(NULL);
+	r->x_cells = GAME_X_CELLS(state);
+	r->o_cells = GAME_O_CELLS(state);
+	snprintf(r->x_name, RECORD_NAME, "%s", player_info[x].name);
+	snprintf(r->o_name, RECORD_NAME, "%s", player_info[o].name);
+	r->result = result;
+	r->moves_len = __builtin_popcount(r->x_cells | r->o_cells);
+	memcpy(r->moves, game->moves, r->moves_len);
+	r->start_us = timing->start_us;
+	memcpy(r->move_us, timing->move_us, r->moves_len * sizeof(uint32_t));
+}
+
+// monotonic time in microseconds
+int64_t monotonicUs(){
+	struct timespec ts;
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0) ERR("clock_gettime");
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// wall clock time in microseconds
+int64_t nowUs(){
+	struct timespec ts;
+	if(clock_gettime(CLOCK_REALTIME, &ts) < 0) ERR("clock_gettime");
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// starts new generation of game record for paired players
+void gameStart(int gameId, int a, int b){
+	game_struct* game = &game_array[gameId];
+	int gen = (GAME_GEN(game->state) + 1) & GAME_GEN_MASK;
+	game_clocks[gameId].start_us = nowUs();
+	game_clocks[gameId].start_mono = monotonicUs();
+	__atomic_store_n(&game->state, (uint64_t)gen << GAME_GEN_SHIFT, __ATOMIC_RELEASE);
+	player_array[a].game = player_array[b].game = gameId;
+	player_array[a].gamegen = player_array[b].gamegen = gen;
+	metricsCount(METRIC_GAMES_STARTED, 1);
+}
+
+// unpacks game state into printable board
+void gameBoard(uint64_t state, char* board){
+	int i;
+	clearBoard(board);
+	for(i = 0; i < GAME_CELLS; i++){
+		if(GAME_X_CELLS(state) & (1ULL << i)){
+			board[i] = X;
+		} else if(GAME_O_CELLS(state) & (1ULL << i)){
+			board[i] = O;
+		}
+	}
+	board[GAME_CELLS] = '\0';
+}
+
+// private chat with opponent
 void chatPrv(int num, char* data){
 	char buf[MAX_LEN];
 	int opponentSocket;
 	
-	// exclusive access to pipe and player_array
-	lockSemaphore(0);
+	// exclusive access to player name and opponent
+	lockPlayer(num);
 	
 	opponentSocket = player_array[num].pairsocket;
-	fprintf(stderr, "[%s] %s\n", player_array[num].name, data );
-	sprintf(buf, "[%s]: %s", player_array[num].name, data );
-	unlockSemaphore(0);
+	fprintf(stderr, "[%s] %s\n", player_info[num].name, data );
+	snprintf(buf, MAX_LEN, "[%s]: %s", player_info[num].name, data );
+	unlockPlayer(num);
 	
 	if (-1 != opponentSocket){
-		if(bulk_write(opponentSocket, buf, MAX_LEN) < 0) ERR("chat prv write:");		
+		sendMsg(opponentSocket, MSG_CHAT, buf, strlen(buf));
 	}
 }
 
 // chat to all
 void chatAll(int num, char* data){	
 	char buf[MAX_LEN];
-	int pipefd;
 	
-	// exclusive access to pipe and player_array
-	lockSemaphore(0);
+	// exclusive access to player name
+	lockPlayer(num);
 	
-	// write pipe
-	pipefd = pipes[1];
-	fprintf(stderr, "[%s] %s\n", player_array[num].name, data );
-	sprintf(buf, "[%s]: %s", player_array[num].name, data );
+	fprintf(stderr, "[%s] %s\n", player_info[num].name, data );
+	memset(buf, 0, MAX_LEN);
+	snprintf(buf, MAX_LEN, "[%s]: %s", player_info[num].name, data );
 
-	unlockSemaphore(0);
-					
-	if(bulk_write(pipefd, buf, MAX_LEN) < 0) ERR("chat all write:");
+	unlockPlayer(num);
 
+	// every broadcaster delivers it to its own players
+	chatPublish(MSG_CHATALL, "", -1, buf);
 }
 
-// returns message type
+// checks room name and returns its length, names are single words
+int roomName(char* name){
+	int len = strcspn(name, " ");
+	if(0 == len || len >= ROOM_NAME){
+		return 0;
+	}
+	return len;
+}
+
+// chat to room, data is room name followed by message
+void chatRoom(int num, char* data){
+	char buf[MAX_LEN];
+	char room[ROOM_NAME];
+	int len;
+
+	if(0 == (len = roomName(data))){
+		return;
+	}
+	snprintf(room, ROOM_NAME, "%.*s", len, data);
+	data += len + (' ' == data[len]);
+
+	// exclusive access to player name
+	lockPlayer(num);
+	fprintf(stderr, "[%s] #%s %s\n", player_info[num].name, room, data );
+	snprintf(buf, MAX_LEN, "[%s] #%s: %s", player_info[num].name, room, data );
+	unlockPlayer(num);
+
+	chatPublish(MSG_ROOM, room, -1, buf);
+}
+
+// joins or leaves room, broadcaster applies it in order with messages
+void chatMember(int num, int type, char* room){
+	char buf[MAX_LEN];
+	if(0 == roomName(room) || ' ' == room[roomName(room)]){
+		sendText(player_array[num].socket, "Room name is one word up to 31 characters");
+		return;
+	}
+	chatPublish(type, room, num, "");
+	snprintf(buf, MAX_LEN, "%s #%s", MSG_JOIN == type ? "Joined" : "Left", room);
+	sendText(player_array[num].socket, buf);
+}
+
+// returns message type of legacy text frame
 int getMsgType(char* data){
 
 	// checks proper move (00-19)
 	if( ('0' == data[0]
 		|| '1' == data[0]) 
 		&& data[1] >= '0'){
-		return MOVE;
+		return MSG_MOVE;
 		
 	// checks proper move (20-24)
 	} else if('2' == data[0] 
 				&& data[1] >= '0' 
 				&& data[1]<'5'){
-		return MOVE;
+		return MSG_MOVE;
 		
 	// if CHATALL
 	} else if ('@' == data[0]){
-		return CHATALL;
+		return MSG_CHATALL;
+
+	// room message and membership
+	} else if ('#' == data[0]){
+		return MSG_ROOM;
+	} else if (0 == strncmp(data, "/join ", 6)){
+		return MSG_JOIN;
+	} else if (0 == strncmp(data, "/leave ", 7)){
+		return MSG_LEAVE;
+	} else if (0 == strncmp(data, "/resume ", 8)){
+		return MSG_RESUME;
+	}
+	return MSG_CHAT;
+}
+
+// decodes legacy fixed frame
+void msgLegacy(char* frame, msg_struct* m){
+	frame[MAX_LEN - 1] = '\0';
+	m->type = getMsgType(frame);
+	m->move = (frame[0] - '0') * 10 + frame[1] - '0';
+
+	// room commands keep only what binary frames carry
+	switch(m->type){
+		case MSG_ROOM:
+			frame += 1;
+			break;
+		case MSG_JOIN:
+			frame += 6;
+			break;
+		case MSG_LEAVE:
+			frame += 7;
+			break;
+		case MSG_RESUME:
+			frame += 8;
+			break;
+	}
+	strcpy(m->text, frame);
+}
+
+// decodes binary frame payload, returns 0 if frame should be ignored
+int msgBinary(int type, char* payload, int len, msg_struct* m){
+	m->type = type;
+	m->move = -1;
+	m->text[0] = '\0';
+	switch(type){
+		case MSG_MOVE:
+			if(1 != len) return 0;
+			m->move = (unsigned char)payload[0];
+			return 1;
+
+		// chat all keeps legacy @ prefix so it is logged and relayed the same way
+		case MSG_CHATALL:
+			// legacy frame holds prefix and at most MAX_LEN - 2 characters
+			if(len > MAX_LEN - 2){
+				len = MAX_LEN - 2;
+			}
+			m->text[0] = '@';
+			memcpy(m->text + 1, payload, len);
+			m->text[len + 1] = '\0';
+			return 1;
+		case MSG_NICK:
+		case MSG_CHAT:
+		case MSG_ROOM:
+		case MSG_JOIN:
+		case MSG_LEAVE:
+		case MSG_RESUME:
+			memcpy(m->text, payload, len);
+			m->text[len] = '\0';
+			return 1;
+	}
+	return 0;
+}
+
+// switches player to binary protocol if hello carries known magic
+void playerHello(int num, char* payload, int len){
+	if(len != strlen(PROTO_MAGIC) || memcmp(payload, PROTO_MAGIC, len)){
+		return;
+	}
+	lockPlayer(num);
+	player_array[num].proto = PROTO_BINARY;
+	unlockPlayer(num);
+}
+
+// reads one message from blocking player socket, returns 0 when connection ends
+// hello is only accepted instead of nickname, later 0xFF is just legacy text
+int playerRead(int playerId, int socket, int nick, msg_struct* m){
+	char frame[MAX_LEN + PROTO_HEADER];
+	int len;
+	for(;;){
+		if(1 != bulk_read(socket, frame, 1)){
+			return 0;
+		}
+		if(PROTO_LEGACY == player_array[playerId].proto
+			&& !(nick && PROTO_HELLO == (unsigned char)frame[0])){
+			if(MAX_LEN - 1 != bulk_read(socket, frame + 1, MAX_LEN - 1)){
+				return 0;
+			}
+			msgLegacy(frame, m);
+			return 1;
+		}
+		if(1 != bulk_read(socket, frame + 1, 1)){
+			return 0;
+		}
+		len = (unsigned char)frame[1];
+		if(len != bulk_read(socket, frame + PROTO_HEADER, len)){
+			return 0;
+		}
+		if(PROTO_HELLO == (unsigned char)frame[0]){
+			playerHello(playerId, frame + PROTO_HEADER, len);
+		} else if(msgBinary((unsigned char)frame[0], frame + PROTO_HEADER, len, m)){
+			return 1;
+		}
 	}
-	return CHATPRV;
 }
 
 // setup communication with new player
-int playerCommunicationInit(int playerId,FILE* fLog){
-	ssize_t size;
-	char data[MAX_LEN];
+int playerCommunicationInit(int playerId){
+	msg_struct m;
 	int socket;
-	lockSemaphore(0);
+	lockPlayer(playerId);
 	socket = player_array[playerId].socket;
-	unlockSemaphore(0);
+	unlockPlayer(playerId);
 
 	for(;;){
-		size = bulk_read(socket, data, MAX_LEN);
-		if(MAX_LEN == size){
-			lockSemaphore(0);
-			
-			// MOVE
-			if( (player_array[playerId].movieing)
-				&& (MOVE == getMsgType(data))){
-				unlockSemaphore(0);
-				int data0 = (int)data[0]-'0';
-				int data1 = (int)data[1]-'0';
-				int move = data0 * 10 + data1;
-				playerMove(playerId, move, fLog);
-				
-			// CHATALL
-			} else if(CHATALL == (getMsgType(data))){
-				unlockSemaphore(0);
-				chatAll(playerId, data );				
-			
-			// CHATPRV type
-			} else {
-				unlockSemaphore(0);
-				chatPrv(playerId, data );
-			}	
+		if(playerRead(playerId, socket, 0, &m)){
+			batchBegin();
+			playerMessage(playerId, &m);
+			batchEnd();
 		} else {
 			if(safe_close(socket) < 0) ERR("close");
 			return 0;
@@ -552,40 +1514,52 @@ int playerCommunicationInit(int playerId,FILE* fLog){
 	return 1;
 }
 
+// handle single message received from playing player
+void playerMessage(int playerId, msg_struct* m){
+	int64_t start;
+	metricsCount(METRIC_MESSAGES, 1);
+
+	// MOVE
+	if( (MSG_MOVE == m->type)
+		&& isPlayerTurn(playerId)){
+		start = metricsNow();
+		TRACE_BEGIN("move");
+		playerMove(playerId, m->move);
+		TRACE_END("move");
+		metricsObserve(HIST_MOVE, metricsNow() - start);
+		
+	// CHATALL
+	} else if(MSG_CHATALL == m->type){
+		chatAll(playerId, m->text );				
+	
+	// rooms
+	} else if(MSG_ROOM == m->type){
+		chatRoom(playerId, m->text);
+	} else if(MSG_JOIN == m->type || MSG_LEAVE == m->type){
+		chatMember(playerId, m->type, m->text);
+	
+	// CHATPRV type, legacy moves out of turn are chat too
+	} else if('\0' != m->text[0]){
+		chatPrv(playerId, m->text );
+	}	
+}
+
 // set starting player and save user nickname
 int playerInit(int playerId){
-	ssize_t size;
-	char data[MAX_LEN];
+	msg_struct m;
 	
-	// exclusive read player socket and game state
-	lockSemaphore(0);	
+	// exclusive read player socket
+	lockPlayer(playerId);	
 	int socket = player_array[playerId].socket;
-	char* board = player_array[playerId].board;		
-	unlockSemaphore(0);	
+	unlockPlayer(playerId);	
 
 	// get data from player
 	sendText(socket, "Your nickname: ");
-	size = bulk_read(socket, data, MAX_LEN);
 
-	if(MAX_LEN == size){
-		lockSemaphore(0);		
-		
-		// save player_array name
-		strcpy(player_array[playerId].name, data);
-		if (NOTPLAYING == player_array[playerId].state 
-			&& NOTPLAYING == player_array[player_array[playerId].pairnum].state){
-			
-			// set whos move is now
-			player_array[playerId].movieing = 1;
-			player_array[player_array[playerId].pairnum].movieing = 0;
-			player_array[playerId].state = PLAYING;			
-			unlockSemaphore(0);
-			
-			// send board to player_array
-			sendBoard(socket, board);						
-		} else {
-			unlockSemaphore(0);					
-		}	
+	if(playerRead(playerId, socket, 1, &m)){
+		batchBegin();
+		playerNickname(playerId, m.text);
+		batchEnd();
 		return 1;
 	} else {
 		if(safe_close(socket) < 0) ERR("close");
@@ -593,13 +1567,50 @@ int playerInit(int playerId){
 	}
 
 }
+
+// save nickname of player who is not paired yet
+void playerName(int playerId, char* data){
+	lockPlayer(playerId);
+	snprintf(player_info[playerId].name, sizeof(player_info[playerId].name), "%s", data);
+	unlockPlayer(playerId);
+}
+
+// save nickname, first named player of the pair starts the game
+void playerNickname(int playerId, char* data){
+
+	char board[GAME_CELLS + 1];
+
+	// exclusive read player socket and game state
+	lockGame(playerId);		
+	int socket = player_array[playerId].socket;
+	
+	// save player_array name
+	snprintf(player_info[playerId].name, sizeof(player_info[playerId].name), "%s", data);
+	if (NOTPLAYING == player_array[playerId].state 
+		&& NOTPLAYING == player_array[player_array[playerId].pairnum].state){
+		
+		// player becomes X, game record starts with X turn
+		player_array[playerId].state = PLAYING;			
+		unlockGame(playerId);
+		
+		// send board to player_array
+		gameBoard(__atomic_load_n(&game_array[player_array[playerId].game].state, __ATOMIC_ACQUIRE), board);
+		sendBoard(socket, board);						
+	} else {
+		unlockGame(playerId);					
+	}	
+}
 // disconnects player_array and logs game in the log file
-void disconnectplayer_array(int playerId, FILE* fLog){
+void disconnectplayer_array(int playerId){
 	char data[MAX_LEN];	
+	record_struct record;
 	time_t tt;	
 	struct tm *t; 	
+
+	// remaining player can not move any more
+	uint64_t state = gameAbandon(playerId);
 	
-	lockSemaphore(0);	
+	lockGame(playerId);	
 	// player is not IDLE
 	if(IDLE < player_array[playerId].state){
 		// finish transmition
@@ -612,43 +1623,90 @@ void disconnectplayer_array(int playerId, FILE* fLog){
 			// get local time
 			t = localtime(&tt);				
 			// format date 
-			sprintf( data, "#%s gracz:  %s kontra gracz: %s nierozstrzygniete\n", asctime(t), player_array[ playerId ].name, player_array[player_array[ playerId ].pairnum].name );	
-			unlockSemaphore(0);	
+			sprintf( data, "#%s gracz:  %s kontra gracz: %s nierozstrzygniete\n", asctime(t), player_info[ playerId ].name, player_info[player_array[ playerId ].pairnum].name );	
+			// player who started plays X
+			gameRecord(&record, playerId, player_array[ playerId ].pairnum, state, RESULT_ABANDONED);
+			unlockGame(playerId);	
 			
 			fprintf(stderr,"%s",data);
 			
-			lockSemaphore(1);
-			fputs(data, fLog);
-			fputs(player_array[ playerId ].board,fLog);
-			fputs("\n",fLog);
-			unlockSemaphore(1);		
+			logGame(&record);
 		} else {
-			unlockSemaphore(0);
+			unlockGame(playerId);
 		}
 	}
 	else
-	unlockSemaphore(0);
+	unlockGame(playerId);
+}
+
+// sets up player of socket accepted by forking server, pair starts playing in own processes
+void serverPlayerAdd(int socketfd, int socket){
+	int playerId, playerId2;
+	send_limit(socket);
+
+	// slots lock themselves while being claimed
+	if (-1 == (playerId = addPlayer(socket))){
+		sendFull(socket);
+		if(safe_close(socket) < 0) ERR("close");
+		return;
+	}
+	playerId2 = getUnpairedPlayer(playerId);
+
+	// try game start
+	if (playerId2 >= 0){
+		mainClientProcess(socketfd, player_array[playerId2].socket, playerId2);
+		mainClientProcess(socketfd, socket, playerId);
+	}
+}
+
+// accepts batch of pending connections of one listener and forks players,
+// rest of backlog wakes pselect again
+void serverAccept(int socketfd, int listenfd){
+	int sockets[ACCEPT_BATCH];
+	int64_t accepted = metricsNow();
+	int i, n;
+	TRACE_BEGIN("accept");
+	n = add_new_clients(listenfd, sockets, ACCEPT_BATCH, SOCK_CLOEXEC);
+	metricsCount(METRIC_ACCEPTED, n);
+	for(i = 0; i < n; i++){
+		if(unix_fd != listenfd){
+			no_delay(sockets[i]);
+		}
+		serverPlayerAdd(socketfd, sockets[i]);
+		metricsObserve(HIST_ACCEPT, metricsNow() - accepted);
+	}
+	TRACE_END("accept");
 }
 
 // initiate player and communication with it or handle disconnects
-void mainClientProcess( int socketfd, int socket, int playerId, FILE* fLog){
+void mainClientProcess( int socketfd, int socket, int playerId){
+	int init;
 	pid_t pid = fork();
 	// parent work
 	if (0 == pid){
 		if(safe_close(socketfd) < 0)ERR("close1");
-		if (1 == playerInit(playerId)){			
-			playerCommunicationInit(playerId, fLog);
+		if(-1 != unix_fd && safe_close(unix_fd) < 0) ERR("close");
+		TRACE_FORK("player", playerId);
+
+		// chat tails and their write locks belong to broadcaster
+		memset(chat_tail_len, 0, sizeof(int) * slot_size);
+		TRACE_BEGIN("playerInit");
+		init = playerInit(playerId);
+		TRACE_END("playerInit");
+		if (1 == init){
+			playerCommunicationInit(playerId);
 		}
 		if (player_array[ playerId ].state < FINISHED){
-			disconnectplayer_array(player_array[ playerId ].pairnum, fLog);		
+			disconnectplayer_array(player_array[ playerId ].pairnum);		
 		}
 		exit(EXIT_SUCCESS);
 	// child work
 	} else {
 		if (pid > 0 )	{
-			lockSemaphore(0);
+			lockPlayer(playerId);
 			player_array[ playerId ].pid = pid;
-			unlockSemaphore(0);
+			unlockPlayer(playerId);
+			pidMapPut(pid, playerId);
 			
 		//on error
 		} else {
@@ -656,291 +1714,2376 @@ void mainClientProcess( int socketfd, int socket, int playerId, FILE* fLog){
 		}
 	}
 }
-void broadcastListen( int pipefd ){
+
+// reads chat doorbell and delivers new messages, returns number of lagging players
+int broadcastListen( int pipefd ){
 	char data[MAX_LEN];
-	int size;
-	int i = 0; 
-	int state = -1; 
-	int socket = -1;
-	
-	// read data
-	if ( ((size = bulk_read(pipefd,data,MAX_LEN)) < 0) 
-		|| (size != MAX_LEN) 
-		|| (0 == data[0]) ){
-		
-		if (do_work){
-			if(safe_close(pipefd) < 0) ERR("close");
-		}		
-	}			
+	ssize_t size;
 
-	// broadcast it to player_array
-	for(i=0;i<MAX_player_array;i++)	{	
-		lockSemaphore(0);
-		socket = player_array[i].socket;
-		state = player_array[i].state;
-		unlockSemaphore(0);
-		if(PLAYING == state
-			|| NOTPLAYING == state){
-			if (-1 != socket){				
-				if(bulk_write(socket,data,MAX_LEN)<0) ERR("broadcastListen");					
-			}
-		}
-	}	
+	// one byte per message, any number of them means just check the ring
+	while((size = TEMP_FAILURE_RETRY(read(pipefd, data, MAX_LEN))) > 0);
+	if(size < 0 && EAGAIN != errno) ERR("read pipe");
+	return broadcastFrame();
 }
 
-void mainServerProcess(int socketfd, FILE* fLog){
-	int socket, fdmax, firstsocket, playerId, playerId2;
-	int pipeStatus, pipefd;
-	fd_set base_rfds, rfds;
-	sigset_t mask, oldmask;	
-	 
-	// on pipe fail
-	if (-1 == (pipeStatus = pipe(pipes))) { 		
-   		perror("pipe");
-    	exit(1);
-	}
-	// get pipe read
-	pipefd = pipes[0];
-	
-	// set masks
-	FD_ZERO(&base_rfds);
-	FD_SET(socketfd, &base_rfds);
-	FD_SET(pipefd, &base_rfds);
-	
-	// get max file descriptor
-	fdmax = (socketfd > pipefd ? socketfd : pipefd);
+// applies membership changes published since last call and marks receivers
+// of new messages, then delivers to marked players only
+// returns number of players that could not take all of their messages
+int broadcastFrame(){
+	chat_entry_struct* e;
+	uint64_t head;
+	int i, len, lagging = 0;
 
-	// init empty set
-	sigemptyset (&mask);
-	
-	// add sig_int
-	sigaddset (&mask, SIGINT);
-	
-	socket = -1;
-	sigprocmask (SIG_BLOCK, &mask, &oldmask);
-	
-	while(do_work){			
-		rfds = base_rfds;
-		
-		if(pselect(fdmax + 1,&rfds,NULL,NULL,NULL,&oldmask) > 0){			
-			if(FD_ISSET(pipefd,&rfds)){
-				broadcastListen( pipefd );				
-			}
-			if(FD_ISSET(socketfd,&rfds)){			
-				// add new client
-				socket = add_new_client(socketfd);
-				
-				// get exclusive
-				lockSemaphore(0);
-				playerId = addPlayer(socket);
-				playerId2 = getUnpairedPlayer(playerId);
-				unlockSemaphore(0);
-				
-				// try game start
-				if (playerId2 >= 0){
-					mainClientProcess(socketfd, firstsocket, playerId2, fLog);
-					mainClientProcess(socketfd, socket, playerId, fLog);				
-				} else {
-					firstsocket = socket;
+	TRACE_BEGIN("broadcast");
+	head = __atomic_load_n(&chat->head, __ATOMIC_ACQUIRE);
+	for(; chat_seen < head; chat_seen++){
+
+		// only floods faster than one ring between wakeups lose membership changes
+		if(head - chat_seen >= CHAT_RING){
+			chat_seen = head - CHAT_RING + 1;
+		}
+		e = &chat->entries[chat_seen % CHAT_RING];
+		switch((unsigned char)e->frame[0]){
+			case MSG_JOIN:
+				if(shard_id == e->shard) roomJoin(e->slot, e->room);
+				break;
+			case MSG_LEAVE:
+				if(shard_id == e->shard) roomLeave(e->slot, roomFind(e->room, 0));
+				break;
+			case MSG_ROOM:
+				chatMarkRoom(roomFind(e->room, 0));
+				break;
+			default:
+				for(i = 0; i < slot_next; i++){
+					chatMark(i);
 				}
-			}			
-		} else {
-			if(EINTR == errno) continue;
-			ERR("pselect");
 		}
 	}
-	sigprocmask (SIG_UNBLOCK, &mask, NULL);
+
+	// slot fields are read without lock, a player leaving is skipped on next message
+	len = chat_pending_len;
+	chat_pending_len = 0;
+	for(i = 0; i < len; i++){
+		chat_marked[chat_pending[i]] = -1;
+	}
+	for(i = 0; i < len; i++){
+		if(chatDeliver(chat_pending[i])){
+			chatMark(chat_pending[i]);
+			lagging++;
+		}
+	}
+	TRACE_END("broadcast");
+	return lagging;
 }
-//ustawia wszystkich graczy na nieaktywnych na poczatku
-void setupplayer_array(){
-	int i;
 
-	for (i = 0; i < MAX_player_array; i++){
-		player_array[i].state = IDLE;
+// queues player for delivery if it is connected and not queued yet
+void chatMark(int num){
+	if(-1 != chat_marked[num]
+		|| (PLAYING != player_array[num].state && NOTPLAYING != player_array[num].state)
+		|| -1 == player_array[num].socket){
+		return;
 	}
+	chat_marked[num] = 1;
+	if(chat_pending_len == chat_pending_size){
+		chat_pending_size = chat_pending_size ? chat_pending_size * 2 : INDEX_CHUNK;
+		if(NULL == (chat_pending = realloc(chat_pending, sizeof(int) * chat_pending_size))) ERR("realloc");
+	}
+	chat_pending[chat_pending_len++] = num;
 }
 
-// clears player_array array disconneting them before
-void clearplayer_array(){
+// queues members of room for delivery
+void chatMarkRoom(int room){
 	int i;
-	
-	// get exclusive access to player_array array
-	lockSemaphore(0);
-	for (i = 0; i < MAX_player_array; i++){
-		if (player_array[i].state){	
-			sendSplit(player_array[i].socket);
-			removePlayer(i);			
-		}		
+	if(-1 == room){
+		return;
+	}
+	for(i = 0; i < rooms[room].len; i++){
+		chatMark(rooms[room].members[i]);
 	}
-	unlockSemaphore(0);
 }
 
-// add new player and return its pos in player_array array
-int addPlayer(int socket){
-	int i;
-	for (i = 0; i < MAX_player_array; i++){	
-		if (IDLE == player_array[i].state){			
-			player_array[i].state = NOTPLAYING;
-			player_array[i].socket = socket;
-			player_array[i].pairsocket = -1;
-			player_array[i].movieing = 0;
-			// allocated mem for player name
-			memset(player_array[i].name, 0, 64);			
-			fprintf(stderr,"Hello [%i]!\n", i);
-			return i;
+// queues game record for logger, waits only when logger is whole ring behind
+void logGame(record_struct* record){
+	log_entry_struct* e;
+	uint64_t pos = __atomic_load_n(&game_log->head, __ATOMIC_RELAXED);
+	uint64_t seq;
+
+	for(;;){
+		e = &game_log->entries[pos % LOG_RING];
+		seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+		if(seq == pos){
+			// failed exchange reloads pos
+			if(__atomic_compare_exchange_n(&game_log->head, &pos, pos + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+				break;
+			}
+		} else {
+			// entry from previous lap is not written yet
+			if(seq < pos){
+				logWake();
+				sched_yield();
+			}
+			pos = __atomic_load_n(&game_log->head, __ATOMIC_RELAXED);
 		}
 	}
+	e->record = *record;
+	__atomic_store_n(&e->seq, pos + 1, __ATOMIC_RELEASE);
+	metricsCount(METRIC_GAMES_ENDED, 1);
 
-	return -1;
+	// logger drains on its own every LOG_PERIOD, burst wakes it each half ring
+	if(0 == (pos + 1) % (LOG_RING / 2)){
+		logWake();
+	}
 }
 
-// finds unpaired player and return its array pos or -1 on error, additionally we pair free player to the player with id given
-int getUnpairedPlayer(int freePlayer){
-	int i;
-	for (i = 0; i < MAX_player_array; i++){
-		if (i != freePlayer && player_array[i].state && player_array[i].pairsocket == -1){
-			// pair unpaired player with given
-			player_array[freePlayer].pairsocket = player_array[i].socket;
-			player_array[i].pairsocket = player_array[freePlayer].socket;
-			player_array[freePlayer].pairnum = getBySocket( player_array[freePlayer].pairsocket );
-			player_array[i].pairnum = getBySocket( player_array[i].pairsocket );
-			clearBoard( player_array[freePlayer].board );
-			clearBoard( player_array[i].board );			
-			return i;
-		}	
-	}
-	return -1;
+// wakes logger before its period ends
+void logWake(){
+	__atomic_add_fetch(&game_log->doorbell, 1, __ATOMIC_RELEASE);
+	if(-1 == syscall(SYS_futex, &game_log->doorbell, FUTEX_WAKE, 1, NULL, NULL, 0)) ERR("futex");
 }
 
-// change player state to IDLE
-void removePlayer(int num){
-	if (player_array[num].state)	{
-		player_array[num].state = IDLE;
-		if(safe_close(player_array[num].socket) < 0) ERR("close");
-			fprintf(stderr,"Player: %s left the game\n", player_array[num].name);
-	}
+// opens record file for appending, new file gets header first
+int recordOpen(){
+	record_header_struct header = {RECORD_MAGIC, RECORD_VERSION, sizeof(record_struct), 0};
+	struct stat st;
+	int fd;
+	if(-1 == (fd = TEMP_FAILURE_RETRY(open(RECORD_FILE, O_WRONLY | O_APPEND | O_CREAT, 0644)))) ERR("open");
+	if(fstat(fd, &st) < 0) ERR("fstat");
+	if(0 == st.st_size && bulk_write(fd, (char*)&header, sizeof(header)) < 0) ERR("write");
+	return fd;
 }
 
-// returns platers array pos or -1 on error
-int getBySocket(int socketfd){
-	int i;
-	for (i = 0; i < MAX_player_array; i++){
-		if (player_array[i].state && player_array[i].socket == socketfd){
-			return i;
+// logger process, appends queued records to record file with one write per batch
+// and syncs it at most every LOG_SYNC seconds, exits on stop or when server dies
+void loggerProcess(pid_t parent){
+	struct timespec period = {0, LOG_PERIOD};
+	log_entry_struct* e;
+	uint64_t tail = 0;
+	time_t synced = time(NULL);
+	record_struct* buf;
+	int bell, stop, dirty = 0;
+	int fd, n;
+
+	// own process group keeps logger out of player reaping and terminal SIGINT,
+	// it stops only after every player is gone so no record is lost
+	if(setpgid(0, 0)) ERR("setpgid");
+	if(sethandler(SIG_IGN,SIGINT)) ERR("Seting SIGINT:");
+	if(sethandler(SIG_DFL,SIGCHLD)) ERR("Setting SIGCHLD:");
+	TRACE_FORK("logger", -1);
+	fd = recordOpen();
+	if(NULL == (buf = malloc(LOG_RING * sizeof(record_struct)))) ERR("malloc");
+
+	for(;;){
+		// flags are read before draining so everything queued before stop is written
+		bell = __atomic_load_n(&game_log->doorbell, __ATOMIC_ACQUIRE);
+		stop = __atomic_load_n(&game_log->stop, __ATOMIC_ACQUIRE) || getppid() != parent;
+
+		for(n = 0; n < LOG_RING; n++, tail++){
+			e = &game_log->entries[tail % LOG_RING];
+			if(__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != tail + 1){
+				break;
+			}
+			buf[n] = e->record;
+			__atomic_store_n(&e->seq, tail + LOG_RING, __ATOMIC_RELEASE);
+		}
+		if(n > 0){
+			TRACE_BEGIN("log write");
+			if(bulk_write(fd, (char*)buf, n * sizeof(record_struct)) < 0) ERR("write");
+			TRACE_END("log write");
+			dirty = 1;
+		}
+		if(dirty && (stop || time(NULL) - synced >= LOG_SYNC)){
+			TRACE_BEGIN("log sync");
+			if(fsync(fd) < 0) ERR("fsync");
+			TRACE_END("log sync");
+			synced = time(NULL);
+			dirty = 0;
 		}
-	}
-	return -1;
-}
 
-// returns player_array array pos or -1 on error
-int getByPID(pid_t pid){
-	int i;
-	for (i = 0; i < MAX_player_array; i++){
-		if (player_array[i].state 
-			&& player_array[i].pid == pid){		
-			return i;
+		// whole ring drained, more may be waiting
+		__atomic_store_n(&game_log->tail, tail, __ATOMIC_RELAXED);
+		if(LOG_RING == n){
+			continue;
+		}
+		if(stop){
+			break;
+		}
+		if(-1 == syscall(SYS_futex, &game_log->doorbell, FUTEX_WAIT, bell, &period, NULL, 0)
+			&& EAGAIN != errno
+			&& ETIMEDOUT != errno
+			&& EINTR != errno){
+			ERR("futex");
 		}
 	}
-	return -1;
+
+	free(buf);
+	if(safe_close(fd) < 0) ERR("close");
+	exit(EXIT_SUCCESS);
 }
 
-// sends the board to a player_array
-void sendBoard( int socket, char b[] ){
-	char data[MAX_LEN];
+// appends entry to chat ring and rings doorbell of every broadcaster
+void chatPublish(int type, char* room, int slot, char* data){
+	chat_entry_struct* e;
+	int len = strnlen(data, MAX_LEN - 1);
+	int pipefd = pipes[1];
 	int i;
-	for(i=0; i<5; i++){
-		if(i<2){
-			sprintf(data, "%c | %c | %c | %c | %c\t 0%d | 0%d | 0%d | 0%d | 0%d", b[i*5], b[i*5+1], b[i*5+2], b[i*5+3], b[i*5+4],i*5, i*5+1, i*5+2, i*5+3, i*5+4);
-		} else {
-			sprintf(data, "%c | %c | %c | %c | %c\t %d | %d | %d | %d | %d", b[i*5], b[i*5+1], b[i*5+2], b[i*5+3], b[i*5+4],i*5, i*5+1, i*5+2, i*5+3, i*5+4);
+
+	lockMutex(&chat->lock);
+	e = &chat->entries[chat->head % CHAT_RING];
+	e->frame[0] = type;
+	e->frame[1] = len;
+	memset(e->frame + PROTO_HEADER, 0, MAX_LEN);
+	memcpy(e->frame + PROTO_HEADER, data, len);
+	snprintf(e->room, ROOM_NAME, "%s", room);
+	e->slot = slot;
+	e->shard = shard_id;
+	__atomic_store_n(&chat->head, chat->head + 1, __ATOMIC_RELEASE);
+	unlockMutex(&chat->lock);
+
+	// full doorbell already has a wakeup pending
+	for(i = 0; i < shard_count; i++){
+		if(NULL != shard_pipes){
+			pipefd = shard_pipes[i][1];
 		}
-		if(bulk_write(socket,data,MAX_LEN)<0) ERR("sendBoard");
+		if(TEMP_FAILURE_RETRY(write(pipefd, "", 1)) < 0 && EAGAIN != errno) ERR("chat all write:");
 	}
-	sprintf( data, "You can make move by typing number from 00 to 24.\nChat all simply by preciding your message with @ or chat directly to your opponent");
-	if(bulk_write(socket,data,MAX_LEN)<0) ERR("sendBoard2");	
 }
 
-// clears gaming board with EMPTYCELL symbol
-void clearBoard(char b[])
-{
-	int i;
-	for (i = 0; i < 25; i++)
-		b[i] = EMPTYCELL;
-	
+// tells if chat entry should be sent to player
+int chatFor(int num, chat_entry_struct* e){
+	switch((unsigned char)e->frame[0]){
+		case MSG_CHATALL:
+			return 1;
+		case MSG_ROOM:
+			return roomMember(num, e->room);
+	}
+	return 0;
 }
 
-// send text via socket
-void sendText( int socket, char* str ){
-	char data[MAX_LEN];
-	strcpy( data, str );
-	if(bulk_write(socket,data,MAX_LEN)<0) ERR("sendText");	
-}
+// sends pending chat messages to player without blocking
+// returns 1 if player could not take all of them
+int chatDeliver(int num){
+	int* lock = &player_info[num].write_lock;
+	int lagging;
+	if(reactor_mode){
+		return chatSend(num);
+	}
 
-// sends null to split strings
-void sendSplit( int socket ){
-	sendText( socket, "\0" );
+	// forked player processes write same socket, broadcaster never waits for them
+	if(0 == chat_tail_len[num] && !tryLockMutex(lock)){
+		return 1;
+	}
+	lagging = chatSend(num);
+	if(0 == chat_tail_len[num]){
+		unlockMutex(lock);
+	}
+	return lagging;
 }
 
-// lock sempahore
-void lockSemaphore(int sn){
-	// allocate resource
-	struct sembuf sb = {sn, -1, 0};  
-	if (-1 == semop(semid, &sb, 1)) ERR("semop");
-}
+// sends pending chat messages, forked mode write lock is held by caller
+// returns 1 if player could not take all of them
+int chatSend(int num){
+	char out[CHAT_BATCH * CHAT_FRAME];
+	size_t ends[CHAT_BATCH];
+	uint64_t next[CHAT_BATCH];
+	int socket = player_array[num].socket;
+	int binary = PROTO_BINARY == player_array[num].proto;
+	uint64_t head, n;
+	chat_entry_struct* e;
+	conn_struct* c;
+	ssize_t size;
+	int k, count;
 
-// free semaphor
-void unlockSemaphore(int sn)
-{
-	// allocate resource
-	struct sembuf sb = {sn, -1, 0};  
-	// resource available
-	sb.sem_op = 1; 
-	if (-1 == semop(semid, &sb, 1) ) ERR("semop");
-}
+	// frame cut by full socket goes out before any later one
+	if(!reactor_mode && chat_tail_len[num] && (k = chatTailSend(num, socket))){
+		return 1 == k;
+	}
 
-// create shared memory returns pointer to shared memory block
-void sharedMemoryInit(){
-	key_t key;
-    int shmid;
-	
-	// path to key_t identifier
-    if (-1 == (key = ftok("client.c", 'a'))) ERR("ftok");     
-	// read all, write only owner
-    if (-1 == (shmid = shmget(key, sizeof(player_struct)*MAX_player_array, 0644 | IPC_CREAT))) ERR("shmget");
-	// attaches the shared memory segment to the data segment of the calling process shmat(id, addr, flgs)    
-    if ((player_struct *)(-1) == (player_array = shmat(shmid, (void *)0, 0)) ) ERR("shmat");
-}
+	head = __atomic_load_n(&chat->head, __ATOMIC_ACQUIRE);
+	while(chat_cursor[num] < head){
 
-// detach shared memory
-void removeSharedMem(){
+		// writer lapped slow player, slot being written is never read
+		if(head - chat_cursor[num] >= CHAT_RING){
+			fprintf(stderr, "chat dropped %d messages\n", (int)(head - chat_cursor[num] - CHAT_RING + 1));
+			chat_cursor[num] = head - CHAT_RING + 1;
+		}
 
-	// detaches the shared memory segment
-	if (-1 == shmdt(player_array)) ERR("shmdt");
-}
+		// reactor skips connections that still did not take earlier output
+		if(reactor_mode){
+			if(socket < 0 || socket >= conns_size || NULL == (c = conns[socket]) || c->closing) return 0;
+			if(c->outlen - c->outoff > out_low) return 1;
+		}
 
-// create semaphors
-void semaphorInit(){
-	key_t key;
-    union semun arg;
-    	
-	// path to key_t identifier
-    if (-1 == (key = ftok("client.c", 'a')) ) ERR("ftok");
-	// read & write for all, no execute
-    if (-1 == (semid = semget(key, 2, 0666 | IPC_CREAT))) ERR("semget");
-    arg.val = 1;
-	// set val of both semaphors from group semid
-    if (-1 == (semctl(semid, 0, SETVAL, arg) ) || (-1 == semctl(semid, 1, SETVAL, arg) )) ERR("semctl");
+		// gather frames encoded for this player, other rooms are skipped
+		size = 0;
+		for(n = chat_cursor[num], count = 0; n < head && count < CHAT_BATCH; n++){
+			e = &chat->entries[n % CHAT_RING];
+			if(!chatFor(num, e)){
+				continue;
+			}
+			if(binary){
+				memcpy(out + size, e->frame, PROTO_HEADER + (unsigned char)e->frame[1]);
+				size += PROTO_HEADER + (unsigned char)e->frame[1];
+			} else {
+				memcpy(out + size, e->frame + PROTO_HEADER, MAX_LEN);
+				size += MAX_LEN;
+			}
+			ends[count] = size;
+			next[count++] = n + 1;
+		}
+
+		// frames overwritten while copying are dropped above
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&chat->head, __ATOMIC_ACQUIRE);
+		if(head - chat_cursor[num] >= CHAT_RING){
+			continue;
+		}
+		if(0 == count){
+			chat_cursor[num] = n;
+			continue;
+		}
+
+		if(reactor_mode){
+			connQueue(socket, out, size);
+			chat_cursor[num] = n;
+			continue;
+		}
+		if((size = TEMP_FAILURE_RETRY(send(socket, out, ends[count - 1], MSG_DONTWAIT | MSG_NOSIGNAL))) < 0){
+			return EAGAIN == errno || EWOULDBLOCK == errno;
+		}
+
+		// rest of frame started on full socket is kept and sent on next pass,
+		// later frames wait for it so stream stays in frames
+		for(k = 0; k < count && ends[k] <= size; k++);
+		if(k < count && size > (k ? ends[k - 1] : 0)){
+			chat_tail_len[num] = ends[k] - size;
+			memcpy(chat_tail + (size_t)num * CHAT_FRAME, out + size, chat_tail_len[num]);
+			chat_cursor[num] = next[k];
+			return 1;
+		}
+		if(k < count){
+			if(k){
+				chat_cursor[num] = next[k - 1];
+			}
+			return 1;
+		}
+		chat_cursor[num] = n;
+	}
+	return 0;
+}
+
+// sends kept end of frame without blocking
+// returns 1 if some of it is still left, -1 if player socket failed, 0 otherwise
+int chatTailSend(int num, int socket){
+	char* tail = chat_tail + (size_t)num * CHAT_FRAME;
+	ssize_t size;
+
+	if((size = TEMP_FAILURE_RETRY(send(socket, tail, chat_tail_len[num], MSG_DONTWAIT | MSG_NOSIGNAL))) < 0){
+		if(EAGAIN == errno || EWOULDBLOCK == errno) return 1;
+
+		// player process notices broken socket itself
+		chat_tail_len[num] = 0;
+		return -1;
+	}
+	chat_tail_len[num] -= size;
+	memmove(tail, tail + size, chat_tail_len[num]);
+	return chat_tail_len[num] ? 1 : 0;
+}
+
+// tries once more to finish chat frame cut by full socket of leaving player
+// and releases its write lock, returns 0 if part of frame stays unsent
+int chatTailClose(int num, int socket){
+	int left;
+	if(reactor_mode || 0 == chat_tail_len[num]){
+		return 1;
+	}
+	left = chatTailSend(num, socket) > 0;
+	chat_tail_len[num] = 0;
+	unlockMutex(&player_info[num].write_lock);
+	return !left;
+}
+
+// new player only gets messages sent after it joined
+void chatSubscribe(int num){
+	int i;
+	chat_cursor[num] = __atomic_load_n(&chat->head, __ATOMIC_ACQUIRE);
+	chat_tail_len[num] = 0;
+
+	// processes of previous player of slot are gone, so is any lock they held
+	__atomic_store_n(&player_info[num].write_lock, 0, __ATOMIC_RELEASE);
+	for(i = 0; i < ROOMS_PER_PLAYER; i++){
+		slot_rooms[num * ROOMS_PER_PLAYER + i] = -1;
+	}
+}
+
+// room name hash
+unsigned roomHash(char* name){
+	unsigned h = 2166136261u;
+	while(*name){
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+	}
+	return h;
+}
+
+// returns room index, creates missing room if asked to, -1 if there is none
+int roomFind(char* name, int create){
+	int i, j, size;
+	if(room_map_size){
+		for(i = roomHash(name) & (room_map_size - 1); -1 != room_map[i]; i = (i + 1) & (room_map_size - 1)){
+			if(0 == strcmp(rooms[room_map[i]].name, name)){
+				return room_map[i];
+			}
+		}
+	}
+	if(!create){
+		return -1;
+	}
+
+	// rooms are never removed, map is rebuilt when half full
+	if(rooms_len == rooms_size){
+		rooms_size = rooms_size ? rooms_size * 2 : INDEX_CHUNK;
+		if(NULL == (rooms = realloc(rooms, sizeof(room_struct) * rooms_size))) ERR("realloc");
+	}
+	memset(&rooms[rooms_len], 0, sizeof(room_struct));
+	snprintf(rooms[rooms_len].name, ROOM_NAME, "%s", name);
+	rooms_len++;
+	if(rooms_len * 2 > room_map_size){
+		size = 0;
+		free(room_map);
+		room_map = NULL;
+		room_map_size = room_map_size ? room_map_size * 2 : INDEX_CHUNK;
+		growIndex(&room_map, &size, room_map_size - 1);
+		for(j = 0; j < rooms_len; j++){
+			for(i = roomHash(rooms[j].name) & (room_map_size - 1); -1 != room_map[i]; i = (i + 1) & (room_map_size - 1));
+			room_map[i] = j;
+		}
+	} else {
+		for(i = roomHash(name) & (room_map_size - 1); -1 != room_map[i]; i = (i + 1) & (room_map_size - 1));
+		room_map[i] = rooms_len - 1;
+	}
+	return rooms_len - 1;
+}
+
+// tells if player is in room with given name
+int roomMember(int num, char* name){
+	int i, room;
+	for(i = 0; i < ROOMS_PER_PLAYER; i++){
+		room = slot_rooms[num * ROOMS_PER_PLAYER + i];
+		if(-1 != room && 0 == strcmp(rooms[room].name, name)){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// adds player to room, players are limited to ROOMS_PER_PLAYER rooms
+void roomJoin(int num, char* name){
+	int* spot = NULL;
+	room_struct* r;
+	int i, room;
+	if(roomMember(num, name)){
+		return;
+	}
+	for(i = 0; i < ROOMS_PER_PLAYER && NULL == spot; i++){
+		if(-1 == slot_rooms[num * ROOMS_PER_PLAYER + i]){
+			spot = &slot_rooms[num * ROOMS_PER_PLAYER + i];
+		}
+	}
+	if(NULL == spot){
+		return;
+	}
+	*spot = room = roomFind(name, 1);
+	r = &rooms[room];
+	if(r->len == r->size){
+		r->size = r->size ? r->size * 2 : 8;
+		if(NULL == (r->members = realloc(r->members, sizeof(int) * r->size))) ERR("realloc");
+	}
+	r->members[r->len++] = num;
+}
+
+// removes player from room
+void roomLeave(int num, int room){
+	room_struct* r;
+	int i;
+	if(-1 == room){
+		return;
+	}
+	for(i = 0; i < ROOMS_PER_PLAYER; i++){
+		if(room == slot_rooms[num * ROOMS_PER_PLAYER + i]){
+			slot_rooms[num * ROOMS_PER_PLAYER + i] = -1;
+		}
+	}
+	r = &rooms[room];
+	for(i = 0; i < r->len; i++){
+		if(num == r->members[i]){
+			r->members[i] = r->members[--r->len];
+			return;
+		}
+	}
+}
+
+// removes leaving player from all its rooms
+void roomLeaveAll(int num){
+	int i;
+	for(i = 0; i < ROOMS_PER_PLAYER; i++){
+		roomLeave(num, slot_rooms[num * ROOMS_PER_PLAYER + i]);
+	}
+}
+
+void mainServerProcess(int socketfd){
+	int fdmax;
+	int pipeStatus, pipefd, lagging, ready;
+	fd_set base_rfds, rfds;
+	sigset_t mask, oldmask;	
+	struct timespec retry = {0, CHAT_RETRY};
+	 
+	// on pipe fail, player processes never block on chat all doorbell
+	if (-1 == (pipeStatus = pipe2(pipes, O_NONBLOCK))) { 		
+   		perror("pipe");
+    	exit(1);
+	}
+	// get pipe read
+	pipefd = pipes[0];
+	
+	// set masks
+	FD_ZERO(&base_rfds);
+	FD_SET(socketfd, &base_rfds);
+	FD_SET(pipefd, &base_rfds);
+	
+	// get max file descriptor
+	fdmax = (socketfd > pipefd ? socketfd : pipefd);
+
+	// unix socket players are forked the same way
+	if(-1 != unix_fd){
+		FD_SET(unix_fd, &base_rfds);
+		fdmax = (unix_fd > fdmax ? unix_fd : fdmax);
+	}
+
+	// init empty set
+	sigemptyset (&mask);
+	
+	// add sig_int
+	sigaddset (&mask, SIGINT);
+
+	// reaping locks player slots, it may only run while no lock is held here
+	sigaddset (&mask, SIGCHLD);
+	
+	lagging = 0;
+	sigprocmask (SIG_BLOCK, &mask, &oldmask);
+	
+	while(do_work){			
+		rfds = base_rfds;
+		
+		// players with full sockets are retried after a while
+		ready = pselect(fdmax + 1,&rfds,NULL,NULL,lagging ? &retry : NULL,&oldmask);
+		if(0 == ready){
+			lagging = broadcastFrame();
+			continue;
+		}
+		if(ready > 0){			
+			if(FD_ISSET(pipefd,&rfds)){
+				lagging = broadcastListen( pipefd );				
+			}
+			if(FD_ISSET(socketfd,&rfds)){			
+				serverAccept(socketfd, socketfd);
+			}
+			if(-1 != unix_fd && FD_ISSET(unix_fd,&rfds)){
+				serverAccept(socketfd, unix_fd);
+			}
+		} else {
+			if(EINTR == errno) continue;
+			ERR("pselect");
+		}
+	}
+
+	// remaining children are reaped by main
+	sigdelset (&mask, SIGCHLD);
+	sigprocmask (SIG_UNBLOCK, &mask, NULL);
+}
+
+// registers socket accepted non blocking in reactor, returns -1 on error
+int connOpen(int socket){
+	struct epoll_event ev;
+	conn_struct* c;
+	int size;
+
+	// grow connection table to fit socket
+	if(socket >= conns_size){
+		size = conns_size ? conns_size : MAX_EVENTS;
+		while(size <= socket){
+			size *= 2;
+		}
+		if(NULL == (conns = realloc(conns, sizeof(conn_struct*) * size))) ERR("realloc");
+		memset(conns + conns_size, 0, sizeof(conn_struct*) * (size - conns_size));
+		conns_size = size;
+	}
+	if(NULL == (c = calloc(1, sizeof(conn_struct)))) ERR("calloc");
+	c->playerId = -1;
+	c->phase = CONN_WAITING;
+	conns[socket] = c;
+
+	// edge triggered, both directions are watched for whole connection life
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	ev.data.fd = socket;
+	if(-1 == epoll_ctl(epollfd, EPOLL_CTL_ADD, socket, &ev)) return -1;
+	return 0;
+}
+
+// marks connection to be closed at the end of reactor iteration
+void connDrop(int socket){
+	conn_struct* c = conns[socket];
+	if(NULL == c || c->closing) return;
+	c->closing = 1;
+	if(closing_len == closing_size){
+		closing_size = closing_size ? closing_size * 2 : MAX_EVENTS;
+		if(NULL == (closing = realloc(closing, sizeof(int) * closing_size))) ERR("realloc");
+	}
+	closing[closing_len++] = socket;
+}
+
+// writes pending output until socket would block
+void connFlush(int socket){
+	conn_struct* c = conns[socket];
+	int64_t start;
+	ssize_t size;
+	if(NULL == c || c->closing) return;
+	if(c->outoff < c->outlen){
+		metricsObserve(HIST_QUEUE, c->outlen - c->outoff);
+	}
+	while(c->outoff < c->outlen){
+		start = metricsNow();
+		size = TEMP_FAILURE_RETRY(write(socket, c->out + c->outoff, c->outlen - c->outoff));
+		if(size < 0){
+			if(EAGAIN == errno || EWOULDBLOCK == errno) return;
+			connDrop(socket);
+			return;
+		}
+		metricsObserve(HIST_WRITE, metricsNow() - start);
+		metricsCount(METRIC_WRITTEN, size);
+		c->outoff += size;
+	}
+	c->outoff = c->outlen = 0;
+}
+
+// continues delivery once connection output drained
+void connChat(int socket){
+	char board[GAME_CELLS + 1];
+	conn_struct* c = conns[socket];
+	if(NULL == c || c->closing || c->playerId < 0 || c->outlen){
+		return;
+	}
+
+	// updates dropped by coalescing are replaced with current board
+	if(c->stale){
+		c->stale = 0;
+		gameBoard(__atomic_load_n(&game_array[player_array[c->playerId].game].state, __ATOMIC_ACQUIRE), board);
+		sendBoard(socket, board);
+	}
+	if(PLAYING == player_array[c->playerId].state
+		|| NOTPLAYING == player_array[c->playerId].state){
+		chatDeliver(c->playerId);
+	}
+}
+
+// applies slow client policy when output queue reached high watermark
+// returns 0 if message of given type should not be queued
+int connAdmit(int socket, int type){
+	conn_struct* c;
+	size_t pending;
+	if(!reactor_mode || socket < 0 || socket >= conns_size || NULL == (c = conns[socket]) || c->closing){
+		return 1;
+	}
+	pending = c->outlen - c->outoff;
+	if(pending < out_high){
+		return 1;
+	}
+
+	// game messages are still queued, twice the high watermark bounds them
+	if(SLOW_DISCONNECT == slow_policy || pending >= out_high * 2){
+		fprintf(stderr, "slow client disconnected\n");
+		metricsCount(METRIC_SLOW, 1);
+		connDrop(socket);
+		return 0;
+	}
+	switch(type){
+		case MSG_BOARD:
+		case MSG_DELTA:
+			if(SLOW_COALESCE == slow_policy){
+				c->stale = 1;
+				return 0;
+			}
+			return 1;
+		case MSG_CHAT:
+		case MSG_CHATALL:
+		case MSG_ROOM:
+			return 0;
+	}
+	return 1;
+}
+
+// appends data to connection output, it is sent at the end of reactor iteration
+int connQueue(int socket, char* buf, size_t count){
+	conn_struct* c;
+	int pending;
+	if(socket < 0 || socket >= conns_size || NULL == (c = conns[socket]) || c->closing){
+		return count;
+	}
+
+	// sent bytes are dropped before buffer grows, so its size follows pending
+	// output that watermarks bound instead of all output since it last drained
+	if(c->outoff && c->outlen + count > c->outcap){
+		memmove(c->out, c->out + c->outoff, c->outlen - c->outoff);
+		c->outlen -= c->outoff;
+		c->outoff = 0;
+	}
+	if(c->outlen + count > c->outcap){
+		c->outcap = c->outcap ? c->outcap : MAX_LEN * 8;
+		while(c->outlen + count > c->outcap){
+			c->outcap *= 2;
+		}
+		if(NULL == (c->out = realloc(c->out, c->outcap))) ERR("realloc");
+	}
+	pending = c->outlen > c->outoff;
+	memcpy(c->out + c->outlen, buf, count);
+	c->outlen += count;
+
+	// if output is already pending EPOLLOUT will continue it
+	if(!pending && !c->queued){
+		c->queued = 1;
+		if(flushing_len == flushing_size){
+			flushing_size = flushing_size ? flushing_size * 2 : MAX_EVENTS;
+			if(NULL == (flushing = realloc(flushing, sizeof(int) * flushing_size))) ERR("realloc");
+		}
+		flushing[flushing_len++] = socket;
+	}
+	return count;
+}
+
+// writes output gathered during reactor iteration, one write per connection
+void connFlushQueued(){
+	int i;
+	for(i = 0; i < flushing_len; i++){
+		if(NULL != conns[flushing[i]]){
+			conns[flushing[i]]->queued = 0;
+			connFlush(flushing[i]);
+		}
+	}
+	flushing_len = 0;
+}
+
+// handles complete message according to connection phase
+void connDispatch(conn_struct* c, msg_struct* m){
+	if(CONN_NICK == c->phase && MSG_RESUME == m->type){
+		// unknown session, client may still join as new player
+		if(!sessionResume(player_array[c->playerId].socket, m->text)){
+			sendText(player_array[c->playerId].socket, "Unknown session, your nickname: ");
+		}
+	} else if(CONN_NICK == c->phase && namedFirst()){
+		// player waits for opponent once named, their frames stay queued
+		c->phase = CONN_WAITING;
+		playerName(c->playerId, m->text);
+		sessionIssue(c->playerId);
+		matchEnqueue(c->playerId);
+	} else if(CONN_NICK == c->phase){
+		c->phase = CONN_PLAYING;
+		playerNickname(c->playerId, m->text);
+	} else {
+		playerMessage(c->playerId, m);
+	}
+}
+
+// tells if frame at start of connection input is binary
+// hello is only accepted instead of nickname, later 0xFF is just legacy text
+int connBinary(conn_struct* c){
+	return PROTO_BINARY == player_array[c->playerId].proto
+		|| (CONN_PLAYING != c->phase && c->inlen && PROTO_HELLO == (unsigned char)c->in[0]);
+}
+
+// length of frame at start of connection input, header length if it is not read yet
+size_t connFrameLen(conn_struct* c){
+	// before nickname first byte tells if hello comes, frame after it must not be read
+	if(0 == c->inlen && CONN_PLAYING != c->phase && PROTO_LEGACY == player_array[c->playerId].proto){
+		return 1;
+	}
+	if(!connBinary(c)){
+		return MAX_LEN;
+	}
+	if(c->inlen < PROTO_HEADER){
+		return PROTO_HEADER;
+	}
+	return PROTO_HEADER + (unsigned char)c->in[1];
+}
+
+// decodes complete frame, returns 0 if there is nothing to dispatch
+int connDecode(conn_struct* c, msg_struct* m){
+	int len = c->inlen - PROTO_HEADER;
+	if(!connBinary(c)){
+		msgLegacy(c->in, m);
+		return 1;
+	}
+	if(PROTO_HELLO == (unsigned char)c->in[0]){
+		playerHello(c->playerId, c->in + PROTO_HEADER, len);
+		return 0;
+	}
+	return msgBinary((unsigned char)c->in[0], c->in + PROTO_HEADER, len, m);
+}
+
+// reads and dispatches frames until socket would block
+void connRead(int socket){
+	msg_struct m;
+	conn_struct* c;
+	ssize_t size;
+	size_t len;
+	int decoded;
+	for(;;){
+		c = conns[socket];
+		if(NULL == c || c->closing) return;
+
+		// complete frame, unpaired players keep it until game starts
+		len = connFrameLen(c);
+		if(len == c->inlen){
+			if(CONN_WAITING == c->phase) return;
+			decoded = connDecode(c, &m);
+			c->inlen = 0;
+			if(decoded){
+				connDispatch(c, &m);
+			}
+			continue;
+		}
+		size = TEMP_FAILURE_RETRY(read(socket, c->in + c->inlen, len - c->inlen));
+		if(size < 0){
+			if(EAGAIN == errno || EWOULDBLOCK == errno) return;
+			connDrop(socket);
+			return;
+		}
+		if(0 == size){
+			connDrop(socket);
+			return;
+		}
+		c->inlen += size;
+	}
+}
+
+// releases connection, game of its player is kept if they may resume it
+void connClose(int socket){
+	conn_struct* c = conns[socket];
+	if(c->playerId > -1){
+		if(!sessionDetach(c->playerId)){
+			playerLeave(c->playerId);
+		}
+	} else {
+		if(safe_close(socket) < 0) ERR("close");
+	}
+	free(c->out);
+	free(c);
+	conns[socket] = NULL;
+}
+
+// finishes game of leaving epoll player and frees their slot, kept game has no socket
+void playerLeave(int playerId){
+	int pairnum, socket;
+	lockPlayer(playerId);
+	socket = player_array[playerId].socket;
+	pairnum = player_array[playerId].pairnum;
+
+	// opponent whose connection dropped still has the game
+	if(-1 == player_array[playerId].pairsocket && !sessionKept(pairnum, playerId)){
+		pairnum = -1;
+	}
+	unlockPlayer(playerId);
+
+	// same as forked player process exit
+	if(pairnum > -1 && player_array[playerId].state < FINISHED){
+		disconnectplayer_array(pairnum);
+	}
+
+	// socket number will be reused, opponent must forget it
+	if(pairnum > -1){
+		lockPlayer(pairnum);
+		if(player_array[pairnum].state
+			&& player_array[pairnum].pairsocket == socket){
+			player_array[pairnum].pairsocket = -1;
+			player_array[pairnum].state = FINISHED;
+		}
+		unlockPlayer(pairnum);
+	}
+	removePlayer(playerId);
+}
+
+// closes connections dropped during reactor iteration
+void connReap(){
+	int i;
+
+	// closing may drop further connections so length is rechecked
+	for(i = 0; i < closing_len; i++){
+		connClose(closing[i]);
+	}
+	closing_len = 0;
+}
+
+// flushes output and closes dropped connections, closing may queue more output
+void connFinish(){
+	while(flushing_len || closing_len){
+		connFlushQueued();
+		connReap();
+	}
+}
+
+// asks paired player for nickname and handles already received data
+void reactorPlayerInit(int playerId){
+	int socket = player_array[playerId].socket;
+	TRACE_BEGIN("playerInit");
+	sendText(socket, "Your nickname: ");
+	if(NULL != conns[socket]){
+		conns[socket]->phase = CONN_NICK;
+		connRead(socket);
+	}
+	TRACE_END("playerInit");
+}
+
+// lets matched player play, frames read while they waited are handled now
+void reactorPlayerStart(int playerId){
+	int socket = player_array[playerId].socket;
+	if(NULL != conns[socket]){
+		conns[socket]->phase = CONN_PLAYING;
+		connRead(socket);
+	}
+}
+
+// accepts all pending connections and pairs players
+void reactorAccept(int socketfd){
+	int sockets[ACCEPT_BATCH];
+	int64_t ready = metricsNow();
+	int i, n;
+	TRACE_BEGIN("accept");
+
+	// edge triggered listener reports backlog once, it is drained a batch at a time
+	// until empty and players are set up only after their batch is accepted
+	do {
+		n = add_new_clients(socketfd, sockets, ACCEPT_BATCH, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		metricsCount(METRIC_ACCEPTED, n);
+		for(i = 0; i < n; i++){
+			if(unix_fd != socketfd){
+				no_delay(sockets[i]);
+			}
+			reactorPlayerAdd(sockets[i]);
+			metricsObserve(HIST_ACCEPT, metricsNow() - ready);
+		}
+	} while(n > 0);
+	TRACE_END("accept");
+}
+
+// sets up player of accepted socket and pairs them
+void reactorPlayerAdd(int socket){
+	int playerId, playerId2;
+	if(-1 == connOpen(socket)){
+		perror("connOpen");
+		connDrop(socket);
+		return;
+	}
+
+	// players named first are paired by matchmaking
+	playerId = addPlayer(socket);
+	playerId2 = (playerId > -1 && !namedFirst()) ? getUnpairedPlayer(playerId) : -1;
+
+	// server is full
+	if(-1 == playerId){
+		sendFull(socket);
+		connDrop(socket);
+		return;
+	}
+	conns[socket]->playerId = playerId;
+	if(namedFirst()){
+		reactorPlayerInit(playerId);
+	}
+
+	// try game start
+	if(playerId2 >= 0){
+		reactorPlayerInit(playerId2);
+		reactorPlayerInit(playerId);
+	}
+}
+
+// tells if epoll players are named before pairing
+int namedFirst(){
+	return match_mode || resume_grace > 0;
+}
+
+// tells if player dropped connection while their game against pair is kept
+int sessionKept(int num, int pair){
+	return num > -1 && num < slot_size && detach_since[num] && player_array[num].pairnum == pair;
+}
+
+// issues resume token to named player, only if server keeps games
+void sessionIssue(int num){
+	char buf[MAX_LEN];
+	uint64_t token = 0;
+	int socket = player_array[num].socket;
+	if(!resume_grace){
+		return;
+	}
+	while(0 == token){
+		if(sizeof(token) != getrandom(&token, sizeof(token), 0)) ERR("getrandom");
+	}
+	lockPlayer(num);
+	player_info[num].session = token;
+	unlockPlayer(num);
+	if(PROTO_BINARY == socketProto(socket)){
+		snprintf(buf, MAX_LEN, "%016" PRIx64, token);
+		sendMsg(socket, MSG_SESSION, buf, SESSION_LEN);
+	} else {
+		snprintf(buf, MAX_LEN, "Session %016" PRIx64 ", if connection drops answer nickname prompt with /resume %016" PRIx64, token, token);
+		sendText(socket, buf);
+	}
+}
+
+// keeps running game of player whose connection dropped, returns 0 if there is none
+// opponent may still move, board is sent again when player resumes
+int sessionDetach(int num){
+	uint64_t state;
+	int socket, pairsocket;
+	if(!resume_grace || !player_info[num].session){
+		return 0;
+	}
+	lockGame(num);
+	socket = player_array[num].socket;
+	pairsocket = player_array[num].pairsocket;
+	state = __atomic_load_n(&game_array[player_array[num].game].state, __ATOMIC_ACQUIRE);
+	if(-1 == pairsocket
+		|| player_array[num].state >= FINISHED
+		|| GAME_GEN(state) != player_array[num].gamegen
+		|| (state & GAME_OVER_BIT)){
+		unlockGame(num);
+		return 0;
+	}
+
+	// socket number will be reused, both slots forget it
+	player_array[num].socket = -1;
+	player_array[player_array[num].pairnum].pairsocket = -1;
+	unlockGame(num);
+	if(socket_slots[socket] == num){
+		socket_slots[socket] = -1;
+	}
+	if(safe_close(socket) < 0) ERR("close");
+
+	if(detached_len == detached_size){
+		detached_size = detached_size ? detached_size * 2 : INDEX_CHUNK;
+		if(NULL == (detached = realloc(detached, sizeof(int) * detached_size))) ERR("realloc");
+	}
+	detached[detached_len++] = num;
+	detach_since[num] = monotonicUs();
+	fprintf(stderr,"Player: %s disconnected, game kept for %d s\n", player_info[num].name, resume_grace);
+	sendText(pairsocket, "Opponent disconnected, waiting for them to return");
+	return 1;
+}
+
+// moves connection to kept slot of given token and sends board snapshot
+// returns 0 if no game is kept for the token
+int sessionResume(int socket, char* token){
+	char board[GAME_CELLS + 1];
+	conn_struct* c = conns[socket];
+	uint64_t session;
+	char* end;
+	int i, num, over, proto, pairsocket = -1;
+	int fresh = c->playerId;
+
+	session = strtoull(token, &end, 16);
+	if(0 == session || '\0' != *end){
+		return 0;
+	}
+
+	// only games of dropped players are kept, there are few of them
+	for(i = 0; i < detached_len && player_info[detached[i]].session != session; i++);
+	if(i == detached_len){
+		return 0;
+	}
+	num = detached[i];
+	detached[i] = detached[--detached_len];
+	detach_since[num] = 0;
+
+	// slot taken by new connection is given back without closing its socket
+	lockPlayer(fresh);
+	player_array[fresh].state = IDLE;
+	proto = player_array[fresh].proto;
+	unlockPlayer(fresh);
+	slotFree(fresh);
+
+	// opponent may have left or finished the game meanwhile
+	lockGame(num);
+	player_array[num].socket = socket;
+	player_array[num].proto = proto;
+	over = FINISHED == player_array[num].state;
+	if(!over){
+		pairsocket = player_array[num].pairsocket;
+		player_array[player_array[num].pairnum].pairsocket = socket;
+	}
+	unlockGame(num);
+	socketMapPut(socket, num);
+	c->playerId = num;
+	c->phase = CONN_PLAYING;
+	fprintf(stderr,"Player: %s resumed the game\n", player_info[num].name);
+
+	gameBoard(__atomic_load_n(&game_array[player_array[num].game].state, __ATOMIC_ACQUIRE), board);
+	sendBoard(socket, board);
+	if(over){
+		sendText(socket, "Game ended while you were away");
+		sendSplit(socket);
+	} else {
+		sendText(pairsocket, "Opponent returned");
+	}
+	return 1;
+}
+
+// ends kept games of players who did not return in time
+void sessionTick(){
+	int64_t now = monotonicUs();
+	int i = 0, num;
+	while(i < detached_len){
+		num = detached[i];
+		if(now - detach_since[num] < resume_grace * 1000000LL){
+			i++;
+			continue;
+		}
+		detached[i] = detached[--detached_len];
+		detach_since[num] = 0;
+		if(FINISHED != player_array[num].state){
+			sendText(player_array[num].pairsocket, "Opponent did not return");
+		}
+		playerLeave(num);
+	}
+}
+
+// single process serving all players with edge triggered epoll
+void mainReactorProcess(int socketfd){
+	struct epoll_event ev, events[MAX_EVENTS];
+	sigset_t mask, oldmask;
+	int64_t matched = 0, swept = 0;
+	int i, n, fd, timeout;
+
+	// sharded workers get their pipe from master
+	if(NULL == shard_pipes && -1 == pipe2(pipes, O_NONBLOCK)) ERR("pipe");
+	if(-1 == (epollfd = epoll_create1(EPOLL_CLOEXEC))) ERR("epoll_create1");
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = socketfd;
+	if(-1 == epoll_ctl(epollfd, EPOLL_CTL_ADD, socketfd, &ev)) ERR("epoll_ctl");
+	ev.data.fd = pipes[0];
+	if(-1 == epoll_ctl(epollfd, EPOLL_CTL_ADD, pipes[0], &ev)) ERR("epoll_ctl");
+
+	// shards share one unix listener, exclusive wakeup lets only one of them drain it
+	if(-1 != unix_fd){
+		ev.events = EPOLLIN | EPOLLET | (shard_count > 1 ? EPOLLEXCLUSIVE : 0);
+		ev.data.fd = unix_fd;
+		if(-1 == epoll_ctl(epollfd, EPOLL_CTL_ADD, unix_fd, &ev)) ERR("epoll_ctl");
+	}
+
+	// SIGINT is only delivered while waiting for events
+	sigemptyset (&mask);
+	sigaddset (&mask, SIGINT);
+	sigprocmask (SIG_BLOCK, &mask, &oldmask);
+
+	while(do_work){
+		// waiting rated players are rematched with wider windows, kept games expire
+		timeout = match_mode && wait_len > 0 ? MATCH_PERIOD : detached_len > 0 ? RESUME_PERIOD : -1;
+		if((n = epoll_pwait(epollfd, events, MAX_EVENTS, timeout, &oldmask)) < 0){
+			if(EINTR == errno) continue;
+			ERR("epoll_pwait");
+		}
+		metricsObserve(HIST_EVENTS, n);
+		for(i = 0; i < n; i++){
+			fd = events[i].data.fd;
+			if(socketfd == fd || unix_fd == fd){
+				reactorAccept(fd);
+			} else if(pipes[0] == fd){
+				broadcastListen(pipes[0]);
+			} else {
+				if(events[i].events & EPOLLOUT){
+					connFlush(fd);
+					connChat(fd);
+				}
+				if(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+					connRead(fd);
+				}
+				if(events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)){
+					connDrop(fd);
+				}
+			}
+		}
+		if(match_mode && wait_len > 1 && monotonicUs() - matched >= MATCH_PERIOD * 1000){
+			matchTick();
+			matched = monotonicUs();
+		}
+		if(detached_len > 0 && monotonicUs() - swept >= RESUME_PERIOD * 1000){
+			sessionTick();
+			swept = monotonicUs();
+		}
+		connFinish();
+	}
+	sigprocmask (SIG_UNBLOCK, &mask, NULL);
+}
+
+// grows int array to hold pos, new entries are set to -1
+void growIndex(int** array, int* size, int pos){
+	int n = *size ? *size : INDEX_CHUNK;
+	while(n <= pos){
+		n *= 2;
+	}
+	if(NULL == (*array = realloc(*array, sizeof(int) * n))) ERR("realloc");
+	memset(*array + *size, -1, sizeof(int) * (n - *size));
+	*size = n;
+}
+
+// allocates private indexes of the accepting process
+void indexInit(){
+	free_len = slot_next = slot_size = 0;
+	chat_seen = __atomic_load_n(&chat->head, __ATOMIC_ACQUIRE);
+	memset(wait_head, -1, sizeof(wait_head));
+	memset(wait_tail, -1, sizeof(wait_tail));
+	wait_len = 0;
+	detached_len = 0;
+}
+
+// takes free slot, released slots are reused before never used ones
+// indexes and shared arenas only grow when never used slot is taken
+int slotAlloc(){
+	int size;
+	if(free_len > 0){
+		return free_slots[--free_len];
+	}
+	if(slot_next >= player_capacity){
+		return -1;
+	}
+	if(slot_next >= slot_size){
+		size = slot_size;
+		growIndex(&free_slots, &size, slot_next);
+		size = slot_size;
+		growIndex(&wait_next, &size, slot_next);
+		size = slot_size;
+		growIndex(&wait_prev, &size, slot_next);
+		size = slot_size;
+		growIndex(&wait_bucket, &size, slot_next);
+		if(NULL == (wait_since = realloc(wait_since, sizeof(int64_t) * size))) ERR("realloc");
+		if(NULL == (detach_since = realloc(detach_since, sizeof(int64_t) * size))) ERR("realloc");
+		memset(detach_since + slot_size, 0, sizeof(int64_t) * (size - slot_size));
+		size = slot_size;
+		growIndex(&chat_marked, &size, slot_next);
+		if(NULL == (chat_cursor = realloc(chat_cursor, sizeof(uint64_t) * size))) ERR("realloc");
+		if(NULL == (chat_tail = realloc(chat_tail, (size_t)CHAT_FRAME * size))) ERR("realloc");
+		if(NULL == (chat_tail_len = realloc(chat_tail_len, sizeof(int) * size))) ERR("realloc");
+		if(NULL == (slot_rooms = realloc(slot_rooms, sizeof(int) * ROOMS_PER_PLAYER * size))) ERR("realloc");
+		slot_size = size;
+	}
+	sharedMemoryCommit(slot_next);
+	return slot_next++;
+}
+
+// returns slot to allocator
+void slotFree(int num){
+	free_slots[free_len++] = num;
+}
+
+// maps socket to player slot
+void socketMapPut(int socket, int num){
+	if(socket >= socket_slots_size){
+		growIndex(&socket_slots, &socket_slots_size, socket);
+	}
+	socket_slots[socket] = num;
+}
+
+// pid hash position
+int pidMapHash(pid_t pid){
+	return ((uint32_t)pid * 2654435761u) & (pid_map_size - 1);
+}
+
+// maps pid to player slot, open addressing with linear probing
+void pidMapPut(pid_t pid, int num){
+	pid_t* keys;
+	int* values;
+	int i, size;
+
+	// keep load factor below one half
+	if(2 * (pid_map_len + 1) > pid_map_size){
+		keys = pid_map_keys;
+		values = pid_map_values;
+		size = pid_map_size;
+		pid_map_size = size ? size * 2 : INDEX_CHUNK;
+		if(NULL == (pid_map_keys = calloc(pid_map_size, sizeof(pid_t)))) ERR("calloc");
+		if(NULL == (pid_map_values = calloc(pid_map_size, sizeof(int)))) ERR("calloc");
+		pid_map_len = 0;
+		for(i = 0; i < size; i++){
+			if(keys[i]){
+				pidMapPut(keys[i], values[i]);
+			}
+		}
+		free(keys);
+		free(values);
+	}
+	for(i = pidMapHash(pid); pid_map_keys[i] && pid_map_keys[i] != pid; i = (i + 1) & (pid_map_size - 1));
+	if(!pid_map_keys[i]){
+		pid_map_len++;
+	}
+	pid_map_keys[i] = pid;
+	pid_map_values[i] = num;
+}
+
+// removes pid, following entries are shifted back so lookups need no tombstones
+void pidMapDel(pid_t pid){
+	int i, j, h;
+	if(0 == pid_map_size) return;
+	for(i = pidMapHash(pid); pid_map_keys[i] && pid_map_keys[i] != pid; i = (i + 1) & (pid_map_size - 1));
+	if(!pid_map_keys[i]) return;
+	pid_map_keys[i] = 0;
+	pid_map_len--;
+	for(j = (i + 1) & (pid_map_size - 1); pid_map_keys[j]; j = (j + 1) & (pid_map_size - 1)){
+		h = pidMapHash(pid_map_keys[j]);
+
+		// entry may move to the hole only if its probe run passes it
+		if((j > i && (h <= i || h > j)) || (j < i && h <= i && h > j)){
+			pid_map_keys[i] = pid_map_keys[j];
+			pid_map_values[i] = pid_map_values[j];
+			pid_map_keys[j] = 0;
+			i = j;
+		}
+	}
+}
+
+// adds player to the end of waiting queue of given bucket, unrated players use bucket 0
+void waitPush(int num, int bucket){
+	wait_prev[num] = wait_tail[bucket];
+	wait_next[num] = -1;
+	if(-1 == wait_tail[bucket]){
+		wait_head[bucket] = num;
+	} else {
+		wait_next[wait_tail[bucket]] = num;
+	}
+	wait_tail[bucket] = num;
+	wait_bucket[num] = bucket;
+	wait_since[num] = monotonicUs();
+	wait_len++;
+}
+
+// removes player from waiting queue if they are there
+void waitRemove(int num){
+	int bucket = wait_bucket[num];
+	if(-1 == bucket) return;
+	if(-1 == wait_prev[num]){
+		wait_head[bucket] = wait_next[num];
+	} else {
+		wait_next[wait_prev[num]] = wait_next[num];
+	}
+	if(-1 == wait_next[num]){
+		wait_tail[bucket] = wait_prev[num];
+	} else {
+		wait_prev[wait_next[num]] = wait_prev[num];
+	}
+	wait_prev[num] = wait_next[num] = wait_bucket[num] = -1;
+	wait_len--;
+}
+
+// takes longest waiting player of bucket or -1
+int waitPop(int bucket){
+	int num = wait_head[bucket];
+	if(-1 != num){
+		waitRemove(num);
+	}
+	return num;
+}
+
+//ustawia wszystkich graczy na nieaktywnych na poczatku
+void setupplayer_array(){
+
+	// arena memory is zeroed when committed so slots start IDLE
+	indexInit();
+}
+
+// clears player_array array disconneting them before
+void clearplayer_array(){
+	int i;
+	int state, socket;
+	
+	for (i = 0; i < slot_next; i++){
+		lockPlayer(i);
+		state = player_array[i].state;
+		socket = player_array[i].socket;
+		unlockPlayer(i);
+		if (state){	
+
+			// end marker never follows part of chat frame
+			if(chatTailClose(i, socket)){
+				sendSplit(socket);
+			}
+
+			// reactor only queued end marker, it goes out before socket is closed
+			if(reactor_mode){
+				connFlush(socket);
+			}
+			removePlayer(i);			
+		}		
+	}
+}
+
+// add new player and return its pos in player_array array
+int addPlayer(int socket){
+	int i;
+	if (-1 == (i = slotAlloc())){
+		return -1;
+	}
+	lockPlayer(i);
+	player_array[i].state = NOTPLAYING;
+	player_array[i].pid = 0;
+	player_array[i].socket = socket;
+	player_array[i].pairsocket = -1;
+	player_array[i].pairnum = -1;
+	player_array[i].proto = PROTO_LEGACY;
+	chatSubscribe(i);
+	// allocated mem for player name
+	memset(player_info[i].name, 0, 64);			
+	player_info[i].session = 0;
+	unlockPlayer(i);
+	socketMapPut(socket, i);
+	fprintf(stderr,"Hello [%i]!\n", i);
+	return i;
+}
+
+// finds unpaired player and return its array pos or -1 on error, additionally we pair free player to the player with id given
+int getUnpairedPlayer(int freePlayer){
+	int i;
+
+	// nobody waits so given player becomes the one waiting
+	if (-1 == (i = waitPop(0))){
+		waitPush(freePlayer, 0);
+		return -1;
+	}
+
+	pairPlayers(i, freePlayer);
+	return i;
+}
+
+// pairs waiting player with given one, waiting player slot owns the game record
+void pairPlayers(int waiting, int freePlayer){
+	lockPair(freePlayer, waiting);
+	player_array[freePlayer].pairsocket = player_array[waiting].socket;
+	player_array[waiting].pairsocket = player_array[freePlayer].socket;
+	player_array[freePlayer].pairnum = waiting;
+	player_array[waiting].pairnum = freePlayer;
+	gameStart(waiting, freePlayer, waiting);
+	unlockPair(freePlayer, waiting);
+}
+
+// rating bucket of player waiting in rated queue
+int matchBucket(int rating){
+	int bucket = rating / RATING_BUCKET;
+	return bucket < 0 ? 0 : bucket >= WAIT_BUCKETS ? WAIT_BUCKETS - 1 : bucket;
+}
+
+// longest waiting player in nearest bucket within window around given one, or -1
+// cost depends only on bucket count, never on number of waiting players
+int matchFind(int bucket, int window, int except){
+	int d, b, num;
+	int reach = window / RATING_BUCKET;
+	for(d = 0; d <= reach && d < WAIT_BUCKETS; d++){
+		for(b = bucket - d; b <= bucket + d; b += d ? 2 * d : 1){
+			if(b < 0 || b >= WAIT_BUCKETS){
+				continue;
+			}
+			for(num = wait_head[b]; -1 != num && num == except; num = wait_next[num]);
+			if(-1 != num){
+				return num;
+			}
+		}
+	}
+	return -1;
+}
+
+// rating window of waiting player, it widens while they wait
+int matchWindow(int num, int64_t now){
+	return MATCH_WINDOW + (now - wait_since[num]) * MATCH_WIDEN / 1000000;
+}
+
+// queues named player or starts game at once if opponent is close enough
+// unrated players all wait in bucket 0
+void matchEnqueue(int num){
+	char buf[MAX_LEN];
+	int rating = match_mode ? ratingGet(player_info[num].name) : RATING_START;
+	int bucket = match_mode ? matchBucket(rating) : 0;
+	int opponent = matchFind(bucket, MATCH_WINDOW, num);
+	if(-1 != opponent){
+		matchStart(opponent, num);
+		return;
+	}
+	waitPush(num, bucket);
+	if(match_mode){
+		snprintf(buf, MAX_LEN, "Waiting for opponent, your rating is %d", rating);
+	} else {
+		snprintf(buf, MAX_LEN, "Waiting for opponent");
+	}
+	sendText(player_array[num].socket, buf);
+}
+
+// pairs players whose windows widened enough, longest waiting of each bucket tries
+void matchTick(){
+	int64_t now = monotonicUs();
+	int b, num, opponent;
+	for(b = 0; b < WAIT_BUCKETS; b++){
+		if(-1 == (num = wait_head[b])){
+			continue;
+		}
+		opponent = matchFind(b, matchWindow(num, now), num);
+		if(-1 != opponent){
+			// player who waits longer plays X
+			if(wait_since[opponent] < wait_since[num]){
+				matchStart(opponent, num);
+			} else {
+				matchStart(num, opponent);
+			}
+		}
+	}
+}
+
+// starts rated game, both players are named so first one moves at once
+void matchStart(int x, int o){
+	char board[GAME_CELLS + 1];
+	waitRemove(x);
+	waitRemove(o);
+	pairPlayers(x, o);
+	lockGame(x);
+	player_array[x].state = PLAYING;
+	unlockGame(x);
+	gameBoard(__atomic_load_n(&game_array[player_array[x].game].state, __ATOMIC_ACQUIRE), board);
+	sendBoard(player_array[x].socket, board);
+	reactorPlayerStart(x);
+	reactorPlayerStart(o);
+}
+
+// change player state to IDLE
+void removePlayer(int num){
+	int socket = -1, removed = 0;
+	pid_t pid = 0;
+	lockPlayer(num);
+	if (player_array[num].state)	{
+		player_array[num].state = IDLE;
+		socket = player_array[num].socket;
+		pid = player_array[num].pid;
+		removed = 1;
+
+		// kept game of dropped player has no socket, its chat tail is given up
+		if(-1 != socket){
+			chatTailClose(num, socket);
+		}
+		if(-1 != socket && safe_close(socket) < 0) ERR("close");
+			fprintf(stderr,"Player: %s left the game\n", player_info[num].name);
+		metricsCount(METRIC_LEFT, 1);
+	}
+	unlockPlayer(num);
+
+	// drop slot from indexes and give it back
+	if (removed){
+		waitRemove(num);
+		roomLeaveAll(num);
+		if (-1 != socket && socket_slots[socket] == num){
+			socket_slots[socket] = -1;
+		}
+		if (pid){
+			pidMapDel(pid);
+		}
+		slotFree(num);
+	}
+}
+
+// returns platers array pos or -1 on error
+int getBySocket(int socketfd){
+	if (socketfd < 0 || socketfd >= socket_slots_size){
+		return -1;
+	}
+	return socket_slots[socketfd];
+}
+
+// returns player_array array pos or -1 on error
+int getByPID(pid_t pid){
+	int i;
+	if (0 == pid_map_size){
+		return -1;
+	}
+	for (i = pidMapHash(pid); pid_map_keys[i]; i = (i + 1) & (pid_map_size - 1)){
+		if (pid_map_keys[i] == pid){
+			return pid_map_values[i];
+		}
+	}
+	return -1;
+}
+
+// sends the board to a player_array
+void sendBoard( int socket, char b[] ){
+	sendMsg(socket, MSG_BOARD, b, GAME_CELLS);
+}
+
+// sends cell taken by move, legacy players get whole board rendered
+void sendDelta( int socket, uint64_t state, int move, char symbol ){
+	char board[GAME_CELLS + 1];
+	char delta[3];
+	if(!connAdmit(socket, MSG_DELTA)){
+		return;
+	}
+	if(PROTO_BINARY == socketProto(socket)){
+		delta[0] = move;
+		delta[1] = symbol;
+		delta[2] = __builtin_popcountll(GAME_X_CELLS(state) | GAME_O_CELLS(state));
+		sendMsg(socket, MSG_DELTA, delta, sizeof(delta));
+		return;
+	}
+	gameBoard(state, board);
+	sendBoardText(socket, board);
+}
+
+// sends the board to legacy player as six text frames
+void sendBoardText( int socket, char b[] ){
+	char data[MAX_LEN];
+	int i;
+	for(i=0; i<5; i++){
+		if(i<2){
+			sprintf(data, "%c | %c | %c | %c | %c\t 0%d | 0%d | 0%d | 0%d | 0%d", b[i*5], b[i*5+1], b[i*5+2], b[i*5+3], b[i*5+4],i*5, i*5+1, i*5+2, i*5+3, i*5+4);
+		} else {
+			sprintf(data, "%c | %c | %c | %c | %c\t %d | %d | %d | %d | %d", b[i*5], b[i*5+1], b[i*5+2], b[i*5+3], b[i*5+4],i*5, i*5+1, i*5+2, i*5+3, i*5+4);
+		}
+		if(sendFrame(socket,data,MAX_LEN)<0 && !socketGone(socket)) ERR("sendBoard");
+	}
+	sprintf( data, "You can make move by typing number from 00 to 24.\nChat all simply by preciding your message with @ or chat directly to your opponent.\nJoin room with /join NAME, leave it with /leave NAME and talk there with #NAME");
+	if(sendFrame(socket,data,MAX_LEN)<0 && !socketGone(socket)) ERR("sendBoard2");	
+}
+
+// clears gaming board with EMPTYCELL symbol
+void clearBoard(char b[])
+{
+	int i;
+	for (i = 0; i < 25; i++)
+		b[i] = EMPTYCELL;
+	
+}
+
+// tells player that table is full, socket is closed by caller
+// single nonblocking send so full server never waits for rejected client
+void sendFull(int socket){
+	char data[MAX_LEN];
+	metricsCount(METRIC_REFUSED, 1);
+	memset(data, 0, MAX_LEN);
+	strcpy(data, "Server is full\n");
+	if(TEMP_FAILURE_RETRY(send(socket, data, MAX_LEN, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0){
+		fprintf(stderr, "server full notice dropped\n");
+	}
+}
+
+// tells if last write failed because player disconnected or stopped reading
+// it may happen under player locks, reader of that socket cleans up
+int socketGone(int socket){
+	if(EAGAIN == errno || EWOULDBLOCK == errno){
+
+		// send timeout expired, reader of the socket sees end of stream
+		fprintf(stderr, "slow client disconnected\n");
+		metricsCount(METRIC_SLOW, 1);
+		shutdown(socket, SHUT_RDWR);
+		return 1;
+	}
+	return EPIPE == errno || ECONNRESET == errno;
+}
+
+// returns protocol spoken by player using given socket
+int socketProto(int socket){
+	int num = getBySocket(socket);
+	return num < 0 ? PROTO_LEGACY : player_array[num].proto;
+}
+
+// sends typed message, legacy players get it as fixed text frame
+// protocol is read without lock, binary clients also accept legacy frames
+void sendMsg(int socket, int type, char* data, int len){
+	char frame[MAX_LEN + PROTO_HEADER];
+	if(!connAdmit(socket, type)){
+		return;
+	}
+	if(len > PROTO_MAX_PAYLOAD){
+		len = PROTO_MAX_PAYLOAD;
+	}
+	if(PROTO_BINARY == socketProto(socket)){
+		frame[0] = type;
+		frame[1] = len;
+		memcpy(frame + PROTO_HEADER, data, len);
+		if(sendFrame(socket, frame, PROTO_HEADER + len) < 0 && !socketGone(socket)) ERR("sendMsg");
+		return;
+	}
+	if(MSG_BOARD == type){
+		sendBoardText(socket, data);
+		return;
+	}
+	memset(frame, 0, MAX_LEN);
+	memcpy(frame, data, len);
+	if(sendFrame(socket, frame, MAX_LEN) < 0 && !socketGone(socket)) ERR("sendMsg");
+}
+
+// send text via socket
+void sendText( int socket, char* str ){
+	sendMsg(socket, MSG_TEXT, str, strlen(str));
+}
+
+// sends null to split strings
+void sendSplit( int socket ){
+	sendMsg(socket, MSG_END, "", 0);
 }
 
-// destroy semaphors
-void semaphorRem(){
-	union semun arg;
-    if (-1 == semctl(semid, 0, IPC_RMID, arg)) ERR("semctl");	
+// futex mutex living in shared memory: 0 free, 1 locked, 2 locked with waiters
+// uncontended lock and unlock never enter the kernel
+void lockMutex(int* m){
+	int64_t start = 0;
+	int c = 0;
+	if(__atomic_compare_exchange_n(m, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+		metricsLocked(m, 0);
+		return;
+	}
+	start = metricsNow();
+	TRACE_BEGIN("lock wait");
+	if(2 != c){
+		c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+	}
+	while(0 != c){
+		// sleep only while word still says locked with waiters
+		if(-1 == syscall(SYS_futex, m, FUTEX_WAIT, 2, NULL, NULL, 0)
+			&& EAGAIN != errno
+			&& EINTR != errno){
+			ERR("futex");
+		}
+		c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+	}
+	TRACE_END("lock wait");
+	metricsCount(METRIC_CONTENDED, 1);
+	metricsLocked(m, start);
 }
 
+// takes mutex only if it is free, returns 0 otherwise
+int tryLockMutex(int* m){
+	int c = 0;
+	return __atomic_compare_exchange_n(m, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
 
-int serverInit(char* port, FILE* fLog){
-	int flags_mod;
+// like lockMutex but gives up after given number of seconds, returns 0 then
+int lockMutexTimed(int* m, int seconds){
+	int64_t left, deadline = monotonicUs() + seconds * 1000000LL;
+	struct timespec timeout;
+	int c = 0;
+	if(__atomic_compare_exchange_n(m, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+		return 1;
+	}
+	if(2 != c){
+		c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+	}
+	while(0 != c){
+		if((left = deadline - monotonicUs()) <= 0){
+			return 0;
+		}
+		timeout.tv_sec = left / 1000000;
+		timeout.tv_nsec = left % 1000000 * 1000;
+		if(-1 == syscall(SYS_futex, m, FUTEX_WAIT, 2, &timeout, NULL, 0)
+			&& EAGAIN != errno
+			&& EINTR != errno
+			&& ETIMEDOUT != errno){
+			ERR("futex");
+		}
+		c = __atomic_exchange_n(m, 2, __ATOMIC_ACQUIRE);
+	}
+	return 1;
+}
+
+// release mutex waking one waiter if there are any
+void unlockMutex(int* m){
+	metricsUnlocked(m);
+	if(2 == __atomic_exchange_n(m, 0, __ATOMIC_RELEASE)){
+		if(-1 == syscall(SYS_futex, m, FUTEX_WAKE, 1, NULL, NULL, 0)) ERR("futex");
+	}
+}
+
+// lock single player slot
+void lockPlayer(int num){
+	lockMutex(&player_array[num].lock);
+}
+
+// unlock single player slot
+void unlockPlayer(int num){
+	unlockMutex(&player_array[num].lock);
+}
+
+// lock two slots, lower one first so pairs never deadlock
+void lockPair(int a, int b){
+	if(a == b){
+		lockPlayer(a);
+	} else if(a < b){
+		lockPlayer(a);
+		lockPlayer(b);
+	} else {
+		lockPlayer(b);
+		lockPlayer(a);
+	}
+}
+
+// unlock two slots
+void unlockPair(int a, int b){
+	unlockPlayer(a);
+	if(a != b){
+		unlockPlayer(b);
+	}
+}
+
+// lock player and its opponent, pairnum only changes in the accepting process
+void lockGame(int num){
+	int pair = player_array[num].pairnum;
+	lockPair(num, pair < 0 ? num : pair);
+}
+
+// unlock player and its opponent
+void unlockGame(int num){
+	int pair = player_array[num].pairnum;
+	unlockPair(num, pair < 0 ? num : pair);
+}
+
+// reserves address space for capacity elements of shared memory
+// backed by memfd so children and forked players see growth of the arena
+void arenaInit(arena_struct* arena, char* name, size_t elem, size_t capacity){
+	arena->elem = elem;
+	arena->capacity = capacity;
+	arena->committed = 0;
+	if (-1 == (arena->fd = memfd_create(name, MFD_CLOEXEC))) ERR("memfd_create");
+	// nothing is backed yet, touching it before arenaCommit raises SIGBUS
+	if (MAP_FAILED == (arena->base = mmap(NULL, elem * capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, arena->fd, 0))) ERR("mmap");
+}
+
+// makes sure first count elements are backed, file grows by doubling
+// pages are allocated by kernel only when slot is touched
+void arenaCommit(arena_struct* arena, size_t count){
+	size_t n;
+	if (count <= arena->committed){
+		return;
+	}
+	n = arena->committed ? arena->committed : INDEX_CHUNK;
+	while (n < count){
+		n *= 2;
+	}
+	if (n > arena->capacity){
+		n = arena->capacity;
+	}
+	if (-1 == ftruncate(arena->fd, n * arena->elem)) ERR("ftruncate");
+	arena->committed = n;
+}
+
+// unmaps arena, memory is released after last process unmaps it
+void arenaFree(arena_struct* arena){
+	if (-1 == munmap(arena->base, arena->elem * arena->capacity)) ERR("munmap");
+	if (safe_close(arena->fd) < 0) ERR("close");
+}
+
+// creates chat all ring shared by all player processes and shards
+void chatInit(){
+	arenaInit(&chat_arena, "chat", sizeof(chat_struct), 1);
+	arenaCommit(&chat_arena, 1);
+	chat = (chat_struct*)chat_arena.base;
+}
+
+// creates rating table shared by all player processes and shards
+void ratingInit(){
+	arenaInit(&rating_arena, "ratings", sizeof(rating_struct), 1);
+	arenaCommit(&rating_arena, 1);
+	ratings = (rating_struct*)rating_arena.base;
+}
+
+// finds entry of nickname adding it if needed, NULL when table is full
+// caller holds rating lock
+rating_entry_struct* ratingEntry(char* name){
+	rating_entry_struct* e;
+	unsigned i;
+	for(i = roomHash(name) & (RATING_TABLE - 1); ; i = (i + 1) & (RATING_TABLE - 1)){
+		e = &ratings->entries[i];
+		if(!strncmp(e->name, name, sizeof(e->name))){
+			return e;
+		}
+		if('\0' == e->name[0]){
+			break;
+		}
+	}
+
+	// keep one entry free so lookups always stop
+	if(ratings->len >= RATING_TABLE - 1){
+		return NULL;
+	}
+	ratings->len++;
+	snprintf(e->name, sizeof(e->name), "%s", name);
+	e->rating = RATING_START;
+	return e;
+}
+
+// current rating of nickname
+int ratingGet(char* name){
+	rating_entry_struct* e;
+	int rating = RATING_START;
+	lockMutex(&ratings->lock);
+	if(NULL != (e = ratingEntry(name))){
+		rating = e->rating;
+	}
+	unlockMutex(&ratings->lock);
+	return rating;
+}
+
+// Elo update after game, result is RESULT_X, RESULT_O or RESULT_TIE
+void ratingUpdate(char* x_name, char* o_name, int result){
+	rating_entry_struct *x, *o;
+	double expected, score = RESULT_X == result ? 1 : RESULT_O == result ? 0 : 0.5;
+	int change;
+	lockMutex(&ratings->lock);
+	x = ratingEntry(x_name);
+	o = ratingEntry(o_name);
+	if(NULL != x && NULL != o && x != o){
+		expected = 1 / (1 + pow(10, (o->rating - x->rating) / 400.0));
+		change = lround(RATING_K * (score - expected));
+		x->rating += change;
+		o->rating -= change;
+		x->games++;
+		o->games++;
+	}
+	unlockMutex(&ratings->lock);
+}
+
+// creates game log queue and starts logger process draining it
+void logInit(){
+	int i;
+	arenaInit(&log_arena, "log", sizeof(log_struct), 1);
+	arenaCommit(&log_arena, 1);
+	game_log = (log_struct*)log_arena.base;
+	for(i = 0; i < LOG_RING; i++){
+		game_log->entries[i].seq = i;
+	}
+	switch(logger_pid = fork()){
+		case 0:
+			loggerProcess(getppid());
+		case -1:
+			ERR("fork:");
+	}
+}
+
+// lets logger write what is left and waits for it
+void logStop(){
+	__atomic_store_n(&game_log->stop, 1, __ATOMIC_RELEASE);
+	logWake();
+	if(TEMP_FAILURE_RETRY(waitpid(logger_pid, NULL, 0)) < 0) ERR("waitpid");
+	arenaFree(&log_arena);
+}
+
+// creates metrics of every worker, shards pick their own after fork
+void metricsInit(){
+	metrics_len = shard_count;
+	arenaInit(&metrics_arena, "metrics", sizeof(metrics_struct), metrics_len);
+	arenaCommit(&metrics_arena, metrics_len);
+	metrics_array = (metrics_struct*)metrics_arena.base;
+	metrics = metrics_array;
+}
+
+// monotonic time in nanoseconds, 0 without metrics so nothing is timed
+int64_t metricsNow(){
+	struct timespec ts;
+	if(NULL == metrics){
+		return 0;
+	}
+	if(clock_gettime(CLOCK_MONOTONIC, &ts) < 0) ERR("clock_gettime");
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// adds n to counter of this worker
+void metricsCount(int counter, uint64_t n){
+	if(NULL != metrics){
+		__atomic_add_fetch(&metrics->counters[counter], n, __ATOMIC_RELAXED);
+	}
+}
+
+// bucket of value, relative error stays below 1 / HIST_SUB
+int histBucket(uint64_t value){
+	int e;
+	if(value < HIST_SUB){
+		return value;
+	}
+	e = 63 - __builtin_clzll(value);
+	if(e >= HIST_EXP){
+		return HIST_BUCKETS - 1;
+	}
+	return (e - HIST_SUB_BITS + 1) * HIST_SUB + (int)(value >> (e - HIST_SUB_BITS)) - HIST_SUB;
+}
+
+// first value above bucket
+uint64_t histUpper(int bucket){
+	if(bucket < HIST_SUB){
+		return bucket + 1;
+	}
+	return (uint64_t)(HIST_SUB + bucket % HIST_SUB + 1) << (bucket / HIST_SUB - 1);
+}
+
+// adds value to histogram of this worker
+void metricsObserve(int hist, uint64_t value){
+	hist_struct* h;
+	if(NULL == metrics){
+		return;
+	}
+	h = &metrics->hists[hist];
+	__atomic_add_fetch(&h->buckets[histBucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->sum, value, __ATOMIC_RELAXED);
+}
+
+// records wait for mutex that was just taken, start is 0 if it was free
+void metricsLocked(int* m, int64_t start){
+	int64_t now;
+	if(NULL == metrics){
+		return;
+	}
+	now = metricsNow();
+	metricsObserve(HIST_LOCK_WAIT, start ? now - start : 0);
+	if(lock_held_len < LOCK_DEPTH){
+		lock_held[lock_held_len] = m;
+		lock_taken[lock_held_len++] = now;
+	}
+}
+
+// records hold time of mutex about to be released
+void metricsUnlocked(int* m){
+	int i;
+	if(NULL == metrics){
+		return;
+	}
+	for(i = lock_held_len - 1; i >= 0 && lock_held[i] != m; i--);
+	if(i < 0){
+		return;
+	}
+	metricsObserve(HIST_LOCK_HOLD, metricsNow() - lock_taken[i]);
+	lock_held[i] = lock_held[--lock_held_len];
+	lock_taken[i] = lock_taken[lock_held_len];
+}
+
+// writes value of every counter of every worker in prometheus text format
+void statsCounters(FILE* out){
+	int i, w;
+	for(i = 0; i < METRICS; i++){
+		fprintf(out, "# HELP ttt_%s %s\n", metric_info[i].name, metric_info[i].help);
+		fprintf(out, "# TYPE ttt_%s counter\n", metric_info[i].name);
+		for(w = 0; w < metrics_len; w++){
+			fprintf(out, "ttt_%s{worker=\"%d\"} %" PRIu64 "\n", metric_info[i].name, w,
+				__atomic_load_n(&metrics_array[w].counters[i], __ATOMIC_RELAXED));
+		}
+	}
+}
+
+// writes histogram with buckets up to powers of two and quantiles from HDR buckets
+void statsHistogram(FILE* out, int hist){
+	double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+	metric_info_struct* info = &hist_info[hist];
+	uint64_t buckets[HIST_BUCKETS];
+	uint64_t count, sum, below;
+	int i, k, w;
+
+	fprintf(out, "# HELP ttt_%s %s\n", info->name, info->help);
+	fprintf(out, "# TYPE ttt_%s histogram\n", info->name);
+	for(w = 0; w < metrics_len; w++){
+		// workers keep adding, count is taken from the same copy as buckets
+		count = 0;
+		for(i = 0; i < HIST_BUCKETS; i++){
+			buckets[i] = __atomic_load_n(&metrics_array[w].hists[hist].buckets[i], __ATOMIC_RELAXED);
+			count += buckets[i];
+		}
+		sum = __atomic_load_n(&metrics_array[w].hists[hist].sum, __ATOMIC_RELAXED);
+		for(k = info->low, i = 0, below = 0; k <= info->high; k++){
+			for(; i < HIST_BUCKETS && histUpper(i) <= 1ULL << k; i++){
+				below += buckets[i];
+			}
+			fprintf(out, "ttt_%s_bucket{worker=\"%d\",le=\"%g\"} %" PRIu64 "\n", info->name, w, (double)(1ULL << k) * info->scale, below);
+		}
+		fprintf(out, "ttt_%s_bucket{worker=\"%d\",le=\"+Inf\"} %" PRIu64 "\n", info->name, w, count);
+		fprintf(out, "ttt_%s_sum{worker=\"%d\"} %g\n", info->name, w, sum * info->scale);
+		fprintf(out, "ttt_%s_count{worker=\"%d\"} %" PRIu64 "\n", info->name, w, count);
+	}
+
+	// quantiles are upper bounds of buckets they fall in
+	fprintf(out, "# HELP ttt_%s_quantile Quantiles of ttt_%s.\n", info->name, info->name);
+	fprintf(out, "# TYPE ttt_%s_quantile gauge\n", info->name);
+	for(w = 0; w < metrics_len; w++){
+		count = 0;
+		for(i = 0; i < HIST_BUCKETS; i++){
+			buckets[i] = __atomic_load_n(&metrics_array[w].hists[hist].buckets[i], __ATOMIC_RELAXED);
+			count += buckets[i];
+		}
+		for(k = 0; k < sizeof(quantiles) / sizeof(quantiles[0]) && count; k++){
+			for(i = 0, below = 0; i < HIST_BUCKETS - 1 && (below += buckets[i]) < ceil(quantiles[k] * count); i++);
+			fprintf(out, "ttt_%s_quantile{worker=\"%d\",quantile=\"%g\"} %g\n", info->name, w, quantiles[k], (histUpper(i) - 1) * info->scale);
+		}
+	}
+}
+
+// writes every metric in prometheus text format
+void statsWrite(FILE* out){
+	int i;
+	statsCounters(out);
+	for(i = 0; i < HISTS; i++){
+		statsHistogram(out, i);
+	}
+	fprintf(out, "# HELP ttt_log_queue_depth Game records waiting for logger.\n");
+	fprintf(out, "# TYPE ttt_log_queue_depth gauge\n");
+	fprintf(out, "ttt_log_queue_depth %" PRIu64 "\n",
+		__atomic_load_n(&game_log->head, __ATOMIC_RELAXED) - __atomic_load_n(&game_log->tail, __ATOMIC_RELAXED));
+	fprintf(out, "# HELP ttt_chat_published_total Chat messages and room changes published.\n");
+	fprintf(out, "# TYPE ttt_chat_published_total counter\n");
+	fprintf(out, "ttt_chat_published_total %" PRIu64 "\n", __atomic_load_n(&chat->head, __ATOMIC_RELAXED));
+}
+
+// sends metrics to connected stats client, HTTP GET gets them with HTTP header
+// so both nc -U and curl --unix-socket work
+void statsServe(int client){
+	struct timeval timeout = {1, 0};
+	struct pollfd pfd = {client, POLLIN, 0};
+	char request[MAX_LEN];
+	ssize_t size = 0;
+	size_t len;
+	char* text;
+	FILE* out;
+
+	if(setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout))) ERR("setsockopt");
+
+	// plain clients send nothing, request is waited for only shortly
+	if(TEMP_FAILURE_RETRY(poll(&pfd, 1, 100)) > 0){
+		size = TEMP_FAILURE_RETRY(recv(client, request, MAX_LEN - 1, MSG_DONTWAIT));
+	}
+	if(NULL == (out = open_memstream(&text, &len))) ERR("open_memstream");
+	statsWrite(out);
+	if(fclose(out)) ERR("fclose");
+	if(size >= 4 && 0 == strncmp(request, "GET ", 4)){
+		dprintf(client, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+	}
+	if(bulk_write(client, text, len) < 0 && EPIPE != errno && ECONNRESET != errno && EAGAIN != errno) ERR("write");
+	free(text);
+}
+
+// stats process, serves metrics on unix socket one client at a time
+// until parent stops it or dies
+void statsProcess(pid_t parent, int socketfd){
+	struct pollfd pfd = {socketfd, POLLIN, 0};
+	int client, ready;
+
+	// own process group keeps it out of player reaping and terminal SIGINT
+	if(setpgid(0, 0)) ERR("setpgid");
+	if(sethandler(SIG_IGN,SIGINT)) ERR("Seting SIGINT:");
+	if(sethandler(SIG_DFL,SIGCHLD)) ERR("Setting SIGCHLD:");
+	if(sethandler(sigint_handler,SIGTERM)) ERR("Seting SIGTERM:");
+	TRACE_FORK("stats", -1);
+	metrics = NULL;
+
+	while(do_work && getppid() == parent){
+		if((ready = poll(&pfd, 1, 1000)) < 0){
+			if(EINTR == errno) continue;
+			ERR("poll");
+		}
+		if(0 == ready){
+			continue;
+		}
+		if((client = TEMP_FAILURE_RETRY(accept4(socketfd, NULL, NULL, SOCK_CLOEXEC))) < 0){
+			if(ECONNABORTED == errno || EAGAIN == errno) continue;
+			ERR("accept4");
+		}
+		statsServe(client);
+		if(safe_close(client) < 0) ERR("close");
+	}
+	if(safe_close(socketfd) < 0) ERR("close");
+	exit(EXIT_SUCCESS);
+}
+
+// binds stats socket and starts process serving it
+void statsInit(){
+	int socketfd = bind_unix_socket(stats_path, SOCK_STREAM | SOCK_CLOEXEC);
+
+	switch(stats_pid = fork()){
+		case 0:
+			statsProcess(getppid(), socketfd);
+		case -1:
+			ERR("fork:");
+	}
+	if(safe_close(socketfd) < 0) ERR("close");
+}
+
+// closes unix listener and removes its path
+void unixStop(){
+	if(-1 == unix_fd){
+		return;
+	}
+	if(safe_close(unix_fd) < 0) ERR("close");
+	if(unlink(unix_path) < 0 && ENOENT != errno) ERR("unlink");
+}
+
+// stops stats process and removes its socket
+void statsStop(){
+	if(NULL == stats_path){
+		return;
+	}
+	if(kill(stats_pid, SIGTERM) < 0 && ESRCH != errno) ERR("kill");
+	if(TEMP_FAILURE_RETRY(waitpid(stats_pid, NULL, 0)) < 0) ERR("waitpid");
+	if(unlink(stats_path) < 0 && ENOENT != errno) ERR("unlink");
+}
+
+#ifdef TRACE
+// appends event to private ring, oldest events are overwritten
+void traceEvent(const char* name, char phase){
+	struct timespec ts;
+	trace_event_struct* e = &trace_ring[trace_len % TRACE_RING];
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	e->ts = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	e->name = name;
+	e->phase = phase;
+
+	// dump reads only counted events
+	__atomic_store_n(&trace_len, trace_len + 1, __ATOMIC_RELEASE);
+}
+
+// forked process starts with empty ring and own name, id -1 means none
+void traceFork(const char* name, int id){
+	trace_len = trace_dumped = 0;
+	if(id < 0){
+		snprintf(trace_name, sizeof(trace_name), "%s", name);
+	} else {
+		snprintf(trace_name, sizeof(trace_name), "%s %d", name, id);
+	}
+}
+
+// copies string to buffer, returns its length
+int traceString(char* buf, const char* str){
+	int len = 0;
+	while(str[len]){
+		buf[len] = str[len];
+		len++;
+	}
+	return len;
+}
+
+// formats number to buffer padded with zeros to width, returns its length
+int traceNumber(char* buf, uint64_t n, int width){
+	char digits[20];
+	int len = 0, i;
+	do {
+		digits[len++] = '0' + n % 10;
+		n /= 10;
+	} while(n || len < width);
+	for(i = 0; i < len; i++){
+		buf[i] = digits[len - 1 - i];
+	}
+	return len;
+}
+
+// formats pid and tid fields closing an event
+int tracePid(char* buf, pid_t pid){
+	int len = traceString(buf, ",\"pid\":");
+	len += traceNumber(buf + len, pid, 1);
+	len += traceString(buf + len, ",\"tid\":");
+	len += traceNumber(buf + len, pid, 1);
+	return len;
+}
+
+// SIGUSR1 handler, appends events since last dump to TRACE_FILE in chrome
+// json array format, runs in signal context so only formats by hand and writes
+void traceDump(int sig){
+	int saved = errno;
+	trace_event_struct* e;
+	uint64_t i, end, first;
+	pid_t pid = getpid();
+	int fd, len;
+
+	// main process forwards dump to logger, it has own process group
+	if(pid == trace_main && logger_pid > 0){
+		kill(logger_pid, SIGUSR1);
+	}
+	end = __atomic_load_n(&trace_len, __ATOMIC_ACQUIRE);
+	if(end == trace_dumped || -1 == (fd = open(TRACE_FILE, O_WRONLY | O_APPEND | O_CLOEXEC))){
+		errno = saved;
+		return;
+	}
+	first = end - trace_dumped > TRACE_RING ? end - TRACE_RING : trace_dumped;
+
+	len = traceString(trace_chunk, "{\"name\":\"process_name\",\"ph\":\"M\"");
+	len += tracePid(trace_chunk + len, pid);
+	len += traceString(trace_chunk + len, ",\"args\":{\"name\":\"");
+	len += traceString(trace_chunk + len, trace_name);
+	len += traceString(trace_chunk + len, "\"}},\n");
+	for(i = first; i < end; i++){
+		// chunks end with whole lines, so dumps of other processes only come between them
+		if(len > TRACE_CHUNK - MAX_LEN){
+			bulk_write(fd, trace_chunk, len);
+			len = 0;
+		}
+		e = &trace_ring[i % TRACE_RING];
+		len += traceString(trace_chunk + len, "{\"name\":\"");
+		len += traceString(trace_chunk + len, e->name);
+		len += traceString(trace_chunk + len, "\",\"ph\":\"");
+		trace_chunk[len++] = e->phase;
+		len += traceString(trace_chunk + len, "\",\"ts\":");
+		len += traceNumber(trace_chunk + len, e->ts / 1000, 1);
+		trace_chunk[len++] = '.';
+		len += traceNumber(trace_chunk + len, e->ts % 1000, 3);
+		len += tracePid(trace_chunk + len, pid);
+		len += traceString(trace_chunk + len, "},\n");
+	}
+	bulk_write(fd, trace_chunk, len);
+	safe_close(fd);
+
+	// next dump continues where this one ended
+	trace_dumped = end;
+	errno = saved;
+}
+
+// starts new trace file, viewers accept array without closing bracket so every
+// process appends its events on SIGUSR1, kill -USR1 -- -PGID dumps them all
+void traceInit(){
+	struct sigaction act;
+	int fd;
+	if(-1 == (fd = TEMP_FAILURE_RETRY(open(TRACE_FILE, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)))) ERR("open");
+	if(bulk_write(fd, "[\n", 2) < 0) ERR("write");
+	if(safe_close(fd) < 0) ERR("close");
+	trace_main = getpid();
+
+	// blocking calls of player processes continue after dump
+	memset(&act, 0, sizeof(struct sigaction));
+	act.sa_handler = traceDump;
+	act.sa_flags = SA_RESTART;
+	if(-1 == sigaction(SIGUSR1, &act, NULL)) ERR("sigaction");
+}
+#endif
+
+// create shared memory for locks, games and players
+void sharedMemoryInit(){
+
+	// private arenas, every shard gets its own table and children inherit it
+	arenaInit(&game_arena, "games", sizeof(game_struct), player_capacity);
+	arenaInit(&clock_arena, "game_clocks", sizeof(game_clock_struct), player_capacity);
+	arenaInit(&player_arena, "players", sizeof(player_struct), player_capacity);
+	arenaInit(&info_arena, "player_info", sizeof(player_info_struct), player_capacity);
+
+	// new memory is zeroed so every lock starts free and every player IDLE
+	game_array = (game_struct*)game_arena.base;
+	game_clocks = (game_clock_struct*)clock_arena.base;
+	player_array = (player_struct*)player_arena.base;
+	player_info = (player_info_struct*)info_arena.base;
+}
+
+// grows arenas so slot can be used
+void sharedMemoryCommit(int num){
+	arenaCommit(&game_arena, num + 1);
+	arenaCommit(&clock_arena, num + 1);
+	arenaCommit(&player_arena, num + 1);
+	arenaCommit(&info_arena, num + 1);
+}
+
+// detach shared memory
+void removeSharedMem(){
+	arenaFree(&info_arena);
+	arenaFree(&player_arena);
+	arenaFree(&clock_arena);
+	arenaFree(&game_arena);
+}
+
+int serverInit(char* port){
 	int socketfd;
 	// ignore sigpipe
 	if(sethandler(SIG_IGN,SIGPIPE)) ERR("Seting SIGPIPE:");
@@ -950,40 +4093,223 @@ int serverInit(char* port, FILE* fLog){
 	
 	// pass SIGINT to proper function
 	if(sethandler(sigint_handler,SIGINT)) ERR("Seting SIGINT:");
+
+#ifdef TRACE
+	// every process started below inherits trace handler
+	traceInit();
+#endif
+	
+	// setup log
+	logInit();
+
+	// chat all ring and ratings are shared by shards too
+	chatInit();
+	ratingInit();
+
+	// stats process reads metrics of every worker, log and chat ring
+	if(NULL != stats_path){
+		metricsInit();
+		statsInit();
+	}
+
+	// unix listener is bound once, shards inherit it
+	if(NULL != unix_path){
+		unix_fd = bind_unix_socket(unix_path, SOCK_STREAM | SOCK_NONBLOCK);
+	}
+
+	// sharded workers bind their own listeners and tables
+	if(shard_count > 1){
+		return -1;
+	}
+	socketfd = listenInit(port, 0);
+			
+	sharedMemoryInit();        
+	setupplayer_array();
 	
+	return socketfd;
+}
+
+// bind non blocking listening socket
+int listenInit(char* port, int reuseport){
+	int flags_mod;
+	int socketfd;
+
 	// set socket
-	socketfd = bind_inet_socket(atoi(port),SOCK_STREAM);
+	socketfd = bind_inet_socket(atoi(port),SOCK_STREAM,reuseport);
 	
 	// get flags
 	flags_mod = fcntl(socketfd, F_GETFL) | O_NONBLOCK;
 	
 	// update flags
 	fcntl(socketfd, F_SETFL, flags_mod);
-	
-	// setup log
-	if (NULL == (fLog = fopen(LOGFILE, "a+"))) ERR("fopen");	
-			
-	sharedMemoryInit();        
-	semaphorInit();      
-	setupplayer_array();
-	
+
+	if(-1 == spare_fd && -1 == (spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC))) ERR("open");
 	return socketfd;
 }
 
+// reactor shard with own listener, player table and chat pipe
+void shardProcess(char* port, int shard){
+	int socketfd;
+	int i;
+
+	// keep own pipe read end and write ends of all shards
+	shard_id = shard;
+	TRACE_FORK("shard", shard);
+	if(NULL != metrics){
+		metrics = &metrics_array[shard];
+	}
+	pipes[0] = shard_pipes[shard][0];
+	pipes[1] = shard_pipes[shard][1];
+	for(i = 0; i < shard_count; i++){
+		if(i != shard && safe_close(shard_pipes[i][0]) < 0) ERR("close");
+	}
+
+	socketfd = listenInit(port, 1);
+	sharedMemoryInit();
+	setupplayer_array();
+
+	mainReactorProcess(socketfd);
+	clearplayer_array();
+
+	if(safe_close(socketfd) < 0) ERR("close");
+	removeSharedMem();
+	exit(EXIT_SUCCESS);
+}
+
+// starts reactor shards and waits for SIGINT to stop them
+void mainShardedProcess(char* port){
+	pid_t* pids;
+	sigset_t mask, oldmask;
+	int i;
+
+	if(NULL == (pids = calloc(shard_count, sizeof(pid_t)))) ERR("calloc");
+	if(NULL == (shard_pipes = calloc(shard_count, sizeof(int[2])))) ERR("calloc");
+	for(i = 0; i < shard_count; i++){
+		if(-1 == pipe2(shard_pipes[i], O_NONBLOCK)) ERR("pipe");
+	}
+
+	// master has no player table, workers are reaped below
+	if(sethandler(SIG_DFL,SIGCHLD)) ERR("Setting parent SIGCHLD:");
+
+	sigemptyset (&mask);
+	sigaddset (&mask, SIGINT);
+	sigprocmask (SIG_BLOCK, &mask, &oldmask);
+
+	for(i = 0; i < shard_count; i++){
+		switch(pids[i] = fork()){
+			case 0:
+				sigprocmask (SIG_SETMASK, &oldmask, NULL);
+				shardProcess(port, i);
+			case -1:
+				ERR("fork:");
+		}
+	}
+
+	while(do_work){
+		sigsuspend(&oldmask);
+	}
+	sigprocmask (SIG_UNBLOCK, &mask, NULL);
+
+	for(i = 0; i < shard_count; i++){
+		if(kill(pids[i], SIGINT) < 0 && ESRCH != errno) ERR("kill");
+	}
+	for(i = 0; i < shard_count; i++){
+		if(TEMP_FAILURE_RETRY(waitpid(pids[i], NULL, 0)) < 0) ERR("waitpid");
+		if(safe_close(shard_pipes[i][0]) < 0) ERR("close");
+		if(safe_close(shard_pipes[i][1]) < 0) ERR("close");
+	}
+	free(shard_pipes);
+	free(pids);
+}
+
 int main(int argc, char** argv){  
-	FILE* fLog;
 	int socketfd;	
 	
 	pid_t pid;
+	int opt;
+	char* end;
 	
 	// check arguments
-	if(argc!=2){
+	while(-1 != (opt = getopt(argc, argv, "ew:c:o:p:mb:r:s:u:"))){
+		switch(opt){
+			case 'e':
+				reactor_mode = 1;
+				break;
+			case 'm':
+				match_mode = 1;
+				break;
+			case 'w':
+				reactor_mode = 1;
+				if((shard_count = atoi(optarg)) < 1){
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'c':
+				if((player_capacity = atoi(optarg)) < 2){
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'o':
+				out_high = strtoul(optarg, &end, 10);
+				out_low = ':' == *end ? strtoul(end + 1, NULL, 10) : out_high / 4;
+				if(out_high < OUT_MIN || out_low >= out_high){
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'r':
+				if((resume_grace = atoi(optarg)) < 1){
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 's':
+				stats_path = optarg;
+				break;
+			case 'u':
+				unix_path = optarg;
+				break;
+			case 'b':
+				if((listen_backlog = atoi(optarg)) < 1){
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'p':
+				if(-1 == (slow_policy = slowPolicy(optarg))){
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	// forked players are named only after pairing
+	if(argc - optind != 1 || (namedFirst() && !reactor_mode)){
 		usage(argv[0]);
 		return EXIT_FAILURE;
 	}
 	
-	socketfd = serverInit(argv[1], fLog);
-	mainServerProcess(socketfd,fLog);
+	socketfd = serverInit(argv[optind]);
+	if(shard_count > 1){
+		mainShardedProcess(argv[optind]);
+		unixStop();
+		statsStop();
+		arenaFree(&chat_arena);
+		arenaFree(&rating_arena);
+		logStop();
+		fprintf(stderr,"Serwer zakonczyl prace.\n");
+		return EXIT_SUCCESS;
+	}
+	if(reactor_mode){
+		mainReactorProcess(socketfd);
+	} else {
+		mainServerProcess(socketfd);
+	}
 	clearplayer_array();
 
 	
@@ -995,9 +4321,12 @@ int main(int argc, char** argv){
 	if(safe_close(socketfd) < 0) ERR("close");
 	if(safe_close(pipes[0]) < 0) ERR("close");
 	if(safe_close(pipes[1]) < 0) ERR("close");
+	unixStop();
 	removeSharedMem();    
-	semaphorRem();
-	if(0 != fclose(fLog)) ERR("fclose");
+	statsStop();
+	arenaFree(&chat_arena);
+	arenaFree(&rating_arena);
+	logStop();
 
 	fprintf(stderr,"Serwer zakonczyl prace.\n");
 	return EXIT_SUCCESS;
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "record.h"
+#define ERR(source) (perror(source),\
+		     fprintf(stderr,"%s:%d\n",__FILE__,__LINE__),\
+		     exit(EXIT_FAILURE))
+
+// STATS_STRUCT - totals over scanned records
+typedef struct {
+
+	// games by result, RESULT_X to RESULT_ABANDONED
+	long results[4];
+
+	// games and moves in them
+	long games, moves;
+
+	// games of player given by -p, its wins and losses
+	long player_games, player_wins, player_losses, player_moves;
+
+} stats_struct;
+
+void usage(char* name){
+	fprintf(stderr,"USAGE: %s [-p NAME] [FILE]\n",name);
+	fprintf(stderr,"\t-p NAME\talso count games of given player\n");
+	fprintf(stderr,"\tFILE\trecord file, default %s\n",RECORD_FILE);
+}
+
+// maps record file read only, returns first record and sets their number
+record_struct* mapRecords(char* path, long* count, size_t* size){
+	record_header_struct* header;
+	struct stat st;
+	char* base;
+	int fd;
+
+	if(-1 == (fd = TEMP_FAILURE_RETRY(open(path, O_RDONLY)))) ERR("open");
+	if(fstat(fd, &st) < 0) ERR("fstat");
+	if(st.st_size < sizeof(record_header_struct)){
+		fprintf(stderr, "%s: not a record file\n", path);
+		exit(EXIT_FAILURE);
+	}
+	*size = st.st_size;
+	if(MAP_FAILED == (base = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0))) ERR("mmap");
+	if(close(fd) < 0) ERR("close");
+
+	// one pass from start to end
+	if(madvise(base, *size, MADV_SEQUENTIAL) < 0) ERR("madvise");
+
+	header = (record_header_struct*)base;
+	if(memcmp(header->magic, RECORD_MAGIC, sizeof(header->magic))
+		|| RECORD_VERSION != header->version
+		|| sizeof(record_struct) != header->size){
+		fprintf(stderr, "%s: unknown record format\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	// server may be appending, only whole records count
+	*count = (*size - sizeof(record_header_struct)) / sizeof(record_struct);
+	return (record_struct*)(base + sizeof(record_header_struct));
+}
+
+// adds records to totals, player may be NULL
+void scanRecords(record_struct* r, long count, char* player, stats_struct* s){
+	long i;
+	int x, o;
+	for(i = 0; i < count; i++, r++){
+		s->results[r->result & 3]++;
+		s->moves += r->moves_len;
+		if(NULL == player){
+			continue;
+		}
+		x = !strncmp(r->x_name, player, RECORD_NAME);
+		o = !strncmp(r->o_name, player, RECORD_NAME);
+		if(!x && !o){
+			continue;
+		}
+		s->player_games++;
+		s->player_moves += r->moves_len;
+		if((x && RESULT_X == r->result) || (o && RESULT_O == r->result)){
+			s->player_wins++;
+		} else if((x && RESULT_O == r->result) || (o && RESULT_X == r->result)){
+			s->player_losses++;
+		}
+	}
+	s->games += count;
+}
+
+// percent of part in whole, 0 for empty whole
+double percent(long part, long whole){
+	return whole ? 100.0 * part / whole : 0;
+}
+
+void printStats(stats_struct* s, char* player){
+	printf("games: %ld\n", s->games);
+	printf("X wins: %ld (%.1f%%)\n", s->results[RESULT_X], percent(s->results[RESULT_X], s->games));
+	printf("O wins: %ld (%.1f%%)\n", s->results[RESULT_O], percent(s->results[RESULT_O], s->games));
+	printf("ties: %ld (%.1f%%)\n", s->results[RESULT_TIE], percent(s->results[RESULT_TIE], s->games));
+	printf("abandoned: %ld (%.1f%%)\n", s->results[RESULT_ABANDONED], percent(s->results[RESULT_ABANDONED], s->games));
+	printf("average length: %.2f moves\n", s->games ? (double)s->moves / s->games : 0);
+	if(NULL == player){
+		return;
+	}
+	printf("player %s: %ld games, %ld wins (%.1f%%), %ld losses, average length %.2f moves\n",
+		player, s->player_games, s->player_wins, percent(s->player_wins, s->player_games),
+		s->player_losses, s->player_games ? (double)s->player_moves / s->player_games : 0);
+}
+
+int main(int argc, char** argv){
+	struct timespec start, end;
+	stats_struct stats;
+	record_struct* records;
+	char* player = NULL;
+	char* path = RECORD_FILE;
+	size_t size;
+	long count;
+	double seconds;
+	int opt;
+
+	while(-1 != (opt = getopt(argc, argv, "p:"))){
+		switch(opt){
+			case 'p':
+				player = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if(argc - optind > 1){
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(argc - optind == 1){
+		path = argv[optind];
+	}
+
+	records = mapRecords(path, &count, &size);
+	memset(&stats, 0, sizeof(stats));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	scanRecords(records, count, player, &stats);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printStats(&stats, player);
+
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	fprintf(stderr, "scanned %ld games in %.3f ms, %.0f games/s\n",
+		count, seconds * 1e3, seconds > 0 ? count / seconds : 0);
+
+	if(munmap((char*)records - sizeof(record_header_struct), size) < 0) ERR("munmap");
+	return EXIT_SUCCESS;
+}